@@ -0,0 +1,423 @@
+#include "DebugLogger.h"
+#include "StagingSink.h"
+#include "Timer.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Benchmarks for the logger
+ * Every case is written to a stream that discards its output, so the numbers
+ * are the cost of formatting a message and handing it to the stream
+ * Results are printed one per line as json (default) or csv so they can be
+ * compared between versions
+ *
+ * usage: DebugLoggerBenchmark [--iterations N] [--threads N] [--csv]
+ * */
+
+// every heap allocation in the process is counted, all the replaceable
+// forms of new and delete go through these two so every pair matches
+static std::atomic<uint64_t> allocationCount(0);
+
+static void *countedAllocate(size_t size, size_t alignment) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  void *memory = nullptr;
+
+  if (alignment <= alignof(std::max_align_t)) {
+    memory = malloc(size ? size : 1);
+  } else if (posix_memalign(&memory, alignment, size ? size : 1) != 0) {
+    memory = nullptr;
+  }
+
+  if (!memory) {
+    throw std::bad_alloc();
+  }
+
+  return memory;
+}
+
+static void countedRelease(void *memory) noexcept { free(memory); }
+
+void *operator new(size_t size) {
+  return countedAllocate(size, alignof(std::max_align_t));
+}
+
+void *operator new[](size_t size) {
+  return countedAllocate(size, alignof(std::max_align_t));
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+  return countedAllocate(size, (size_t)alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return countedAllocate(size, (size_t)alignment);
+}
+
+void operator delete(void *memory) noexcept { countedRelease(memory); }
+
+void operator delete[](void *memory) noexcept { countedRelease(memory); }
+
+void operator delete(void *memory, size_t) noexcept { countedRelease(memory); }
+
+void operator delete[](void *memory, size_t) noexcept {
+  countedRelease(memory);
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+  countedRelease(memory);
+}
+
+void operator delete[](void *memory, std::align_val_t) noexcept {
+  countedRelease(memory);
+}
+
+void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+  countedRelease(memory);
+}
+
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept {
+  countedRelease(memory);
+}
+
+/**
+ * Stream buffer which drops everything written to it
+ * */
+class NullBuffer : public std::streambuf {
+protected:
+  int overflow(int c) override { return c; }
+
+  std::streamsize xsputn(const char *, std::streamsize count) override {
+    return count;
+  }
+};
+
+struct BenchmarkResult {
+  std::string name;
+  int threads;
+  uint64_t iterations;
+  double nsPerMessage;
+  double allocationsPerMessage;
+  double messagesPerSecond;
+};
+
+static bool csvOutput = false;
+
+static void printHeader() {
+  if (csvOutput) {
+    printf("benchmark,threads,iterations,ns_per_msg,allocs_per_msg,msgs_per_"
+           "sec\n");
+  }
+}
+
+static void printResult(const BenchmarkResult &result) {
+  if (csvOutput) {
+    printf("%s,%d,%llu,%.2f,%.4f,%.0f\n", result.name.c_str(), result.threads,
+           (unsigned long long)result.iterations, result.nsPerMessage,
+           result.allocationsPerMessage, result.messagesPerSecond);
+  } else {
+    printf("{\"benchmark\":\"%s\",\"threads\":%d,\"iterations\":%llu,"
+           "\"ns_per_msg\":%.2f,\"allocs_per_msg\":%.4f,\"msgs_per_sec\":%.0f}"
+           "\n",
+           result.name.c_str(), result.threads,
+           (unsigned long long)result.iterations, result.nsPerMessage,
+           result.allocationsPerMessage, result.messagesPerSecond);
+  }
+
+  fflush(stdout);
+}
+
+/**
+ * Runs a single threaded case
+ * The first tenth of the iterations warm up the buffers and are not measured
+ * */
+static void runCase(const std::string &name, uint64_t iterations,
+                    const std::function<void(int)> &body) {
+  for (uint64_t i = 0; i < iterations / 10; ++i) {
+    body((int)i);
+  }
+
+  uint64_t allocationsBefore = allocationCount.load();
+  Timer timer;
+
+  for (uint64_t i = 0; i < iterations; ++i) {
+    body((int)i);
+  }
+
+  uint64_t elapsed = timer.nanoseconds();
+  uint64_t allocations = allocationCount.load() - allocationsBefore;
+
+  BenchmarkResult result;
+  result.name = name;
+  result.threads = 1;
+  result.iterations = iterations;
+  result.nsPerMessage = (double)elapsed / (double)iterations;
+  result.allocationsPerMessage = (double)allocations / (double)iterations;
+  result.messagesPerSecond = (double)iterations * 1e9 / (double)elapsed;
+  printResult(result);
+}
+
+/**
+ * Sink which drops everything written to it
+ * */
+class NullSink : public LogSink {
+public:
+  void write(const char *, size_t) override {}
+};
+
+/**
+ * Measures throughput with each thread logging through its own logger
+ * @param sink shared by every thread's logger, or nullptr for a stream each
+ * */
+static void runThreaded(const std::string &name, int threadCount,
+                        uint64_t iterations, LogSink *sink) {
+  std::atomic<int> ready(0);
+  std::atomic<bool> start(false);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < threadCount; ++t) {
+    threads.emplace_back([&]() {
+      NullBuffer nullBuffer;
+      std::ostream nullStream(&nullBuffer);
+      DebugLogger logger;
+      logger.setColorDisabled();
+      logger.setTargetOutput(&nullStream);
+
+      if (sink) {
+        logger.setTargetSink(sink);
+      }
+
+      for (uint64_t i = 0; i < iterations / 10; ++i) {
+        logger.trace("{int} {str}", (int)i, "warmup");
+      }
+
+      ready++;
+      while (!start.load()) {
+        std::this_thread::yield();
+      }
+
+      for (uint64_t i = 0; i < iterations; ++i) {
+        logger.trace("{int} {str}", (int)i, "threaded");
+      }
+    });
+  }
+
+  while (ready.load() != threadCount) {
+    std::this_thread::yield();
+  }
+
+  uint64_t allocationsBefore = allocationCount.load();
+  Timer timer;
+  start = true;
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  if (sink) {
+    sink->flush();
+  }
+
+  uint64_t elapsed = timer.nanoseconds();
+  uint64_t total = iterations * threadCount;
+
+  BenchmarkResult result;
+  result.name = name;
+  result.threads = threadCount;
+  result.iterations = total;
+  result.nsPerMessage = (double)elapsed / (double)total;
+  result.allocationsPerMessage =
+      (double)(allocationCount.load() - allocationsBefore) / (double)total;
+  result.messagesPerSecond = (double)total * 1e9 / (double)elapsed;
+  printResult(result);
+}
+
+int main(int argc, char **argv) {
+  uint64_t iterations = 200000;
+  int maxThreads = (int)std::thread::hardware_concurrency();
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+
+    if (arg == "--iterations" && i + 1 < argc) {
+      iterations = strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--threads" && i + 1 < argc) {
+      maxThreads = atoi(argv[++i]);
+    } else if (arg == "--csv") {
+      csvOutput = true;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--iterations N] [--threads N] [--csv]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (iterations == 0) {
+    iterations = 1;
+  }
+
+  maxThreads = std::max(1, maxThreads);
+
+  NullBuffer nullBuffer;
+  std::ostream nullStream(&nullBuffer);
+
+  DebugLogger logger;
+  logger.setColorDisabled();
+  logger.setTargetOutput(&nullStream);
+
+  int intVar = 42;
+  double floatVar = 3.25;
+  logger.addVariable("intVar", &intVar, DebugVarType::INTEGER32);
+  logger.addVariable("floatVar", &floatVar, DebugVarType::FLOAT64);
+
+  printHeader();
+
+  // default prefix
+  runCase("literal", iterations,
+          [&](int) { logger.trace("plain literal message"); });
+  runCase("char", iterations, [&](int i) { logger.trace("{char}", 'a' + i % 26); });
+  runCase("int", iterations, [&](int i) { logger.trace("{int}", i); });
+  runCase("uint", iterations, [&](int i) { logger.trace("{uint}", i); });
+  runCase("long", iterations,
+          [&](int i) { logger.trace("{long}", (long long)i * 1000003); });
+  runCase("float", iterations,
+          [&](int i) { logger.trace("{float}", i * 0.25); });
+  runCase("string", iterations,
+          [&](int) { logger.trace("{str}", "a string argument"); });
+  runCase("variables", iterations,
+          [&](int) { logger.trace("[intVar] [floatVar]"); });
+
+  // formatting flags
+  runCase("flag_width", iterations, [&](int i) { logger.trace("{10d}", i); });
+  runCase("flag_right", iterations, [&](int i) { logger.trace("{>10d}", i); });
+  runCase("flag_fill_zero", iterations,
+          [&](int i) { logger.trace("{>010d}", i); });
+  runCase("flag_hex", iterations, [&](int i) { logger.trace("{x int}", i); });
+  runCase("flag_upper_hex", iterations,
+          [&](int i) { logger.trace("{X int}", i); });
+  runCase("flag_binary", iterations,
+          [&](int i) { logger.trace("{b int}", i); });
+  runCase("flag_unsigned", iterations,
+          [&](int i) { logger.trace("{+int}", -i); });
+  runCase("flag_precision", iterations,
+          [&](int i) { logger.trace("{10.2f}", i * 0.125); });
+  runCase("flag_capital", iterations,
+          [&](int) { logger.trace("{^str}", "capitalize this text"); });
+  runCase("flag_lower", iterations,
+          [&](int) { logger.trace("{$str}", "LOWER THIS TEXT"); });
+
+  // memory buffers
+  unsigned char packet[4096];
+
+  for (size_t i = 0; i < sizeof(packet); ++i) {
+    packet[i] = (unsigned char)(i * 31);
+  }
+
+  runCase("hex_64", iterations,
+          [&](int) { logger.trace("{hex}", packet, 64); });
+  runCase("hexdump_4k", iterations / 100 + 1, [&](int) {
+    logger.trace("{hexdump}", packet, sizeof(packet));
+  });
+
+  // arrays
+  int shardLoads[16];
+  double histogram[16];
+
+  for (int i = 0; i < 16; ++i) {
+    shardLoads[i] = i * 977;
+    histogram[i] = i * 0.375;
+  }
+
+  runCase("array_ints_16", iterations,
+          [&](int) { logger.trace("{ints}", shardLoads, 16); });
+  runCase("array_doubles_16", iterations, [&](int) {
+    logger.trace("{.2doubles}", histogram, 16);
+  });
+
+  // sub-formats
+  runCase("sub_format", iterations,
+          [&](int i) { logger.trace("[25'{str}:] {d}", "column", i); });
+  runCase("sub_format_nested", iterations, [&](int i) {
+    logger.trace("[>30^'{str}: [>8'{d} [$'{s}]]]", "outer", i, "INNER");
+  });
+
+  // prefix variants
+  logger.setPrefix("");
+  runCase("empty_prefix_int", iterations,
+          [&](int i) { logger.trace("{int}", i); });
+  logger.setPrefix("[3ln] [ctx]: ");
+
+  {
+    LogContext request("request", "8f3a5c");
+    LogContext tenant("tenant", "acme");
+    runCase("context_prefix_int", iterations,
+            [&](int i) { logger.trace("{int}", i); });
+  }
+
+  logger.setPrefix(DEFAULT_PREFIX);
+
+  // messages rejected by the level
+  logger.setLevel(Level::LEVEL_ERROR);
+  runCase("filtered_trace", iterations,
+          [&](int i) { logger.trace("{int} {str}", i, "filtered"); });
+  runCase("filtered_lazy", iterations, [&](int i) {
+    logger.trace("{sv}", [&] { return std::to_string(i); });
+  });
+
+  // rejected messages kept in memory instead
+  logger.enableBacktrace(256);
+  runCase("backtrace_capture", iterations,
+          [&](int i) { logger.trace("{int} {str}", i, "kept"); });
+  logger.disableBacktrace();
+  logger.setLevel(Level::LEVEL_TRACE);
+
+  // baselines printing the same text as the default prefix + {int}
+  FILE *nullFile = fopen(
+#if defined(WIN32) | defined(__WIN32) || defined(_WIN32)
+      "NUL",
+#else
+      "/dev/null",
+#endif
+      "w");
+
+  if (nullFile) {
+    runCase("baseline_printf", iterations, [&](int i) {
+      fprintf(nullFile, "%s~%.2f [%05d]: %d\n", "TCE", .12, i, i);
+    });
+  }
+
+  char buffer[256];
+  runCase("baseline_snprintf", iterations, [&](int i) {
+    snprintf(buffer, sizeof(buffer), "%s~%.2f [%05d]: %d\n", "TCE", .12, i, i);
+  });
+
+  runCase("baseline_cout", iterations, [&](int i) {
+    nullStream << "TCE" << "~" << .12 << " [" << i << "]: " << i << "\n";
+  });
+
+  if (nullFile) {
+    fclose(nullFile);
+  }
+
+  // thread scaling
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    runThreaded("threaded_trace", threads, iterations, nullptr);
+  }
+
+  // every thread's lines merged in time order into one sink
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    NullSink nullSink;
+    StagingSink staging(nullSink);
+    runThreaded("staged_trace", threads, iterations, &staging);
+  }
+
+  return 0;
+}
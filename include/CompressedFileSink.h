@@ -0,0 +1,313 @@
+#ifndef INCLUDE_COMPRESSED_FILE_SINK_H
+#define INCLUDE_COMPRESSED_FILE_SINK_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "DebugLogger.h"
+#include "FileSink.h"
+#include "LogCompression.h"
+#include "LogSink.h"
+
+/**
+ * Writes lines to a file compressed in blocks, see LogCompression.h for the
+ * layout. Lines are copied into the current block, and full blocks are
+ * compressed and written by a background thread, so the logging thread
+ * only ever copies
+ * The dictionary should hold text the log repeats: prefixes, format strings
+ * and names. It is stored at the start of the file and can only be changed
+ * before the first line is written
+ * Read the file back with CompressedLogReader or DebugLoggerDecompress
+ * POSIX only
+ * */
+class CompressedFileSink : public LogSink {
+public:
+  /**
+   * @param blockSize the amount of text compressed together, at most
+   * LogCompression::MAX_BLOCK_SIZE
+   * @param maxPendingBlocks full blocks waiting for the background thread
+   * before write() waits for it
+   * */
+  CompressedFileSink(const char *path, size_t blockSize = 1 << 18,
+                     size_t maxPendingBlocks = 8)
+      : descriptor(::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+        blockSize(std::clamp(blockSize, (size_t)1,
+                             LogCompression::MAX_BLOCK_SIZE)),
+        maxPendingBlocks(maxPendingBlocks ? maxPendingBlocks : 1),
+        current(newBlock()), worker(&CompressedFileSink::run, this) {}
+
+  ~CompressedFileSink() {
+    flush();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+
+    workReady.notify_all();
+    worker.join();
+
+    if (descriptor >= 0) {
+      ::close(descriptor);
+    }
+  }
+
+  CompressedFileSink(const CompressedFileSink &) = delete;
+  CompressedFileSink &operator=(const CompressedFileSink &) = delete;
+
+  bool isOpen() const { return descriptor >= 0; }
+
+  /**
+   * Adds text to the dictionary, the text added last is the cheapest to
+   * refer to. Only the last 64KB are kept
+   * @return false once the first line has been written
+   * */
+  bool addDictionary(std::string_view text) {
+    if (headerWritten.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    dictionary.insert(dictionary.end(), text.begin(), text.end());
+    dictionary.push_back('\n');
+
+    if (dictionary.size() > LogCompression::MAX_DICTIONARY) {
+      dictionary.erase(dictionary.begin(),
+                       dictionary.end() - LogCompression::MAX_DICTIONARY);
+    }
+
+    return true;
+  }
+
+  /**
+   * Adds the logger's prefix of every level, as it currently prints
+   */
+  bool addDictionary(DebugLogger &logger) {
+    LogBuffer prefix;
+
+    for (int l = (int)Level::LEVEL_TRACE; l < (int)Level::LEVEL_COUNT; ++l) {
+      prefix.clear();
+      logger.formatMessage(prefix, (Level)l, "");
+
+      if (!addDictionary(std::string_view(prefix.data(), prefix.size()))) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void write(const char *data, size_t size) override {
+    writeHeader();
+
+    while (size > 0) {
+      size_t used = current->used.load(std::memory_order_relaxed);
+      size_t count = std::min(size, blockSize - used);
+
+      memcpy(current->text() + used, data, count);
+      current->used.store(used + count, std::memory_order_release);
+      data += count;
+      size -= count;
+
+      if (used + count == blockSize) {
+        submit();
+      }
+    }
+  }
+
+  /**
+   * Compresses the partial block and waits until everything is written
+   * */
+  void flush() override {
+    writeHeader();
+
+    if (current->used.load(std::memory_order_relaxed) > 0) {
+      submit();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this] { return pending.empty() && !busy; });
+  }
+
+  /**
+   * Writes the partial block uncompressed, blocks still queued for the
+   * background thread are lost
+   * */
+  void flushFromSignal() override {
+    if (!headerWritten.load(std::memory_order_acquire)) {
+      return;
+    }
+
+    Block *block = current;
+    size_t used = block->used.exchange(0, std::memory_order_acquire);
+
+    if (used) {
+      writeStored(block->data.get(), used);
+    }
+  }
+
+  void writeFromSignal(const char *data, size_t size) override {
+    char block[LogCompression::BLOCK_HEADER_SIZE + 1024];
+
+    if (!headerWritten.load(std::memory_order_acquire)) {
+      return;
+    }
+
+    size = std::min(size, sizeof(block) - LogCompression::BLOCK_HEADER_SIZE);
+    memcpy(block + LogCompression::BLOCK_HEADER_SIZE, data, size);
+    writeStored(block, size);
+  }
+
+  /**
+   * Returns the bytes of text given to the sink and the bytes written to
+   * the file for them, once the background thread has written them
+   * */
+  uint64_t getBytesIn() const { return bytesIn.load(); }
+
+  uint64_t getBytesOut() const { return bytesOut.load(); }
+
+private:
+  /**
+   * Text of a block, with room in front for its header
+   * */
+  struct Block {
+    explicit Block(size_t size)
+        : data(new char[LogCompression::BLOCK_HEADER_SIZE + size]), used(0) {}
+
+    char *text() { return data.get() + LogCompression::BLOCK_HEADER_SIZE; }
+
+    std::unique_ptr<char[]> data;
+    std::atomic<size_t> used;
+  };
+
+  Block *newBlock() {
+    blocks.emplace_back(new Block(blockSize));
+    return blocks.back().get();
+  }
+
+  void writeHeader() {
+    if (headerWritten.load(std::memory_order_relaxed)) {
+      return;
+    }
+
+    std::vector<char> header(8 + dictionary.size());
+    memcpy(header.data(), LogCompression::MAGIC, 4);
+    LogCompression::writeUInt32(header.data() + 4, (uint32_t)dictionary.size());
+    memcpy(header.data() + 8, dictionary.data(), dictionary.size());
+    BufferedFileSink::writeAll(descriptor, header.data(), header.size());
+    headerWritten.store(true, std::memory_order_release);
+  }
+
+  /**
+   * Writes a block uncompressed in one write() call, header included
+   * @param block the header followed by size bytes of text
+   * */
+  void writeStored(char *block, size_t size) {
+    LogCompression::writeUInt32(block, (uint32_t)size);
+    LogCompression::writeUInt32(block + 4,
+                                (uint32_t)size | LogCompression::STORED_FLAG);
+    BufferedFileSink::writeAll(descriptor, block,
+                               LogCompression::BLOCK_HEADER_SIZE + size);
+  }
+
+  /**
+   * Queues the current block for the background thread and takes an empty
+   * one, waiting if too many blocks are queued
+   * */
+  void submit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    pending.push_back(current);
+    workReady.notify_one();
+
+    if (spare.empty() && blocks.size() < maxPendingBlocks + 2) {
+      current = newBlock();
+      return;
+    }
+
+    drained.wait(lock, [this] { return !spare.empty(); });
+    current = spare.back();
+    spare.pop_back();
+  }
+
+  void run() {
+    Block *block;
+    LogCompression::Compressor compressor;
+    std::vector<char> output;
+
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        workReady.wait(lock, [this] { return !pending.empty() || !running; });
+
+        if (pending.empty()) {
+          return;
+        }
+
+        block = pending.front();
+        pending.pop_front();
+        busy = true;
+      }
+
+      size_t size = block->used.load(std::memory_order_acquire);
+      output.resize(LogCompression::BLOCK_HEADER_SIZE +
+                    LogCompression::compressBound(size));
+      size_t compressed = compressor.compress(
+          dictionary.data(), dictionary.size(), block->text(), size,
+          output.data() + LogCompression::BLOCK_HEADER_SIZE);
+
+      if (compressed < size) {
+        LogCompression::writeUInt32(output.data(), (uint32_t)size);
+        LogCompression::writeUInt32(output.data() + 4, (uint32_t)compressed);
+        BufferedFileSink::writeAll(descriptor, output.data(),
+                                   LogCompression::BLOCK_HEADER_SIZE +
+                                       compressed);
+      } else {
+        compressed = size;
+        writeStored(block->data.get(), size);
+      }
+
+      bytesIn += size;
+      bytesOut += LogCompression::BLOCK_HEADER_SIZE + compressed;
+      block->used.store(0, std::memory_order_release);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        spare.push_back(block);
+        busy = false;
+      }
+
+      drained.notify_all();
+    }
+  }
+
+  int descriptor;
+  size_t blockSize;
+  size_t maxPendingBlocks;
+  std::vector<char> dictionary;
+  std::atomic<bool> headerWritten{false};
+
+  // every block, the one being filled, queued ones and spare ones
+  std::vector<std::unique_ptr<Block>> blocks;
+  Block *current;
+
+  std::mutex mutex;
+  std::condition_variable workReady;
+  std::condition_variable drained;
+  std::deque<Block *> pending;
+  std::vector<Block *> spare;
+  bool busy = false;
+  bool running = true;
+
+  std::atomic<uint64_t> bytesIn{0};
+  std::atomic<uint64_t> bytesOut{0};
+
+  std::thread worker;
+};
+
+#endif
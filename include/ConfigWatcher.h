@@ -0,0 +1,245 @@
+#ifndef INCLUDE_CONFIG_WATCHER_H
+#define INCLUDE_CONFIG_WATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+
+#include "DebugLogger.h"
+
+/**
+ * Reloads a LoggerConfig from a file whenever the file changes
+ * A background thread checks the file's modification time and size every
+ * interval, a file that doesn't parse leaves the config as it is
+ *
+ * file format, one setting per line, # starts a comment:
+ *   level = warning            none, trace, warning, error or critical
+ *   color = off                on, off, true or false
+ *   prefix = "[ln]: "          every level, quotes keep the spaces
+ *   prefix.error = "[ln] !! "  one level
+ * Settings missing from the file keep the values the config had when the
+ * watcher was made, so removing a line undoes it
+ * */
+class ConfigWatcher {
+public:
+  ConfigWatcher(LoggerConfig &config, const std::string &path,
+                uint64_t intervalNanoseconds = 1000000000)
+      : config(config), path(path), interval(intervalNanoseconds),
+        defaults(config.get()) {
+    checkFile();
+    watcher = std::thread(&ConfigWatcher::run, this);
+  }
+
+  ~ConfigWatcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+
+    wake.notify_all();
+    watcher.join();
+  }
+
+  ConfigWatcher(const ConfigWatcher &) = delete;
+  ConfigWatcher &operator=(const ConfigWatcher &) = delete;
+
+  /**
+   * Reads the file and publishes its settings now
+   * @return false if the file can't be read or has an error
+   * */
+  bool reload() {
+    std::ifstream file(path);
+
+    if (!file) {
+      setError(path + ": can't read the file");
+      return false;
+    }
+
+    std::stringstream text;
+    text << file.rdbuf();
+
+    LoggerSettings settings = defaults;
+    std::string error;
+
+    if (!parse(text.str(), settings, error)) {
+      setError(path + ":" + error);
+      return false;
+    }
+
+    config.publish(settings);
+    setError("");
+    return true;
+  }
+
+  /**
+   * Returns why the last reload failed, empty if it didn't
+   * */
+  std::string getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return lastError;
+  }
+
+  /**
+   * Applies the settings in text to settings
+   * @param error set to "line: reason" when it returns false
+   * */
+  static bool parse(const std::string &text, LoggerSettings &settings,
+                    std::string &error) {
+    std::istringstream lines(text);
+    std::string line;
+    int number = 0;
+
+    while (std::getline(lines, line)) {
+      number++;
+      size_t start = line.find_first_not_of(" \t\r");
+
+      if (start == std::string::npos || line[start] == '#') {
+        continue;
+      }
+
+      size_t equals = line.find('=', start);
+
+      if (equals == std::string::npos) {
+        error = std::to_string(number) + ": expected name = value";
+        return false;
+      }
+
+      std::string name = trim(line.substr(start, equals - start));
+      std::string value = trim(line.substr(equals + 1));
+
+      if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+      }
+
+      if (!apply(name, value, settings)) {
+        error = std::to_string(number) + ": bad setting " + name;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+private:
+  static std::string trim(const std::string &text) {
+    size_t start = text.find_first_not_of(" \t\r");
+
+    if (start == std::string::npos) {
+      return "";
+    }
+
+    return text.substr(start, text.find_last_not_of(" \t\r") - start + 1);
+  }
+
+  static bool parseLevel(const std::string &name, Level &level) {
+    const char *names[] = {"none", "trace", "warning", "error", "critical"};
+
+    for (int i = 0; i < (int)Level::LEVEL_COUNT; ++i) {
+      if (name == names[i]) {
+        level = (Level)i;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  static bool apply(const std::string &name, const std::string &value,
+                    LoggerSettings &settings) {
+    if (name == "level") {
+      return parseLevel(value, settings.level);
+    }
+
+    if (name == "color") {
+      settings.colorEnabled = value == "on" || value == "true";
+      return settings.colorEnabled || value == "off" || value == "false";
+    }
+
+    if (name == "prefix") {
+      for (int i = (int)Level::LEVEL_TRACE; i < (int)Level::LEVEL_COUNT; ++i) {
+        settings.prefixFormat[i] = value;
+      }
+
+      return true;
+    }
+
+    Level level;
+
+    if (name.compare(0, 7, "prefix.") == 0 &&
+        parseLevel(name.substr(7), level) && level != Level::NONE) {
+      settings.prefixFormat[(int)level] = value;
+      return true;
+    }
+
+    return false;
+  }
+
+  void setError(const std::string &error) {
+    std::lock_guard<std::mutex> lock(mutex);
+    lastError = error;
+  }
+
+  /**
+   * Reloads if the file changed since the last check
+   * */
+  void checkFile() {
+    struct stat info;
+
+    if (stat(path.c_str(), &info) != 0) {
+      return;
+    }
+
+    // an editor that saves by renaming gives a new inode, two saves in the
+    // same second with the same size differ in the nanoseconds
+    if (info.st_mtim.tv_sec == modified.tv_sec &&
+        info.st_mtim.tv_nsec == modified.tv_nsec && info.st_size == size &&
+        info.st_ino == inode) {
+      return;
+    }
+
+    modified = info.st_mtim;
+    size = info.st_size;
+    inode = info.st_ino;
+    reload();
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (running) {
+      wake.wait_for(lock, std::chrono::nanoseconds(interval));
+
+      if (!running) {
+        break;
+      }
+
+      lock.unlock();
+      checkFile();
+      lock.lock();
+    }
+  }
+
+  LoggerConfig &config;
+  std::string path;
+  uint64_t interval;
+  LoggerSettings defaults;
+
+  // what the file looked like at the last check
+  struct timespec modified = {};
+  off_t size = -1;
+  ino_t inode = 0;
+
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  bool running = true;
+  std::string lastError;
+
+  std::thread watcher;
+};
+
+#endif
@@ -1,17 +1,33 @@
 #ifndef INCLUDE_DEBUG_LOGGER_H
 #define INCLUDE_DEBUG_LOGGER_H
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstdarg>
+#include <initializer_list>
 #include <iostream>
 #include <map>
 #include <math.h>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <sstream>
 #include <stdarg.h>
 #include <string.h>
 #include <string>
-
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "HexFormat.h"
+#include "LatencyHistogram.h"
+#include "LogArgs.h"
+#include "LogBuffer.h"
+#include "LogContext.h"
+#include "LogSink.h"
+#include "NumberFormat.h"
+#include "Simd.h"
 #include "Timer.h"
 
 #if defined(WIN32) | defined(__WIN32) || defined(_WIN32)
@@ -46,6 +62,278 @@ enum class Level {
   LEVEL_COUNT
 };
 
+/**
+ * Counters the logger keeps about its own overhead on one level
+ * messages: messages written
+ * filtered: messages rejected because of the level
+ * nanoseconds: time spent formatting and writing the messages
+ * bytes: bytes of formatted output
+ * bufferGrowths: times the line buffer had to grow for a message, each one
+ * a heap allocation. Allocations made elsewhere, such as by a sink or a user
+ * formatter, are not counted
+ * */
+struct LevelStats {
+  long long messages = 0;
+  long long filtered = 0;
+  long long nanoseconds = 0;
+  long long bytes = 0;
+  long long bufferGrowths = 0;
+};
+
+/**
+ * Snapshot of the logger's counters returned by DebugLogger::getStats
+ * levels[(int)Level::LEVEL_COUNT] is the total of every level
+ * */
+struct LoggerStats {
+  LevelStats levels[(int)Level::LEVEL_COUNT + 1];
+
+  const LevelStats &operator[](Level level) const {
+    return levels[(int)level];
+  }
+};
+
+/**
+ * The parts of a log call that latency is recorded for
+ * TOTAL: the whole call, FORMAT: building the line, WRITE: the stream write
+ * */
+enum class LatencyPhase { TOTAL, FORMAT, WRITE, PHASE_COUNT };
+
+/**
+ * The prefix every logger starts with
+ * */
+constexpr const char *DEFAULT_PREFIX = "[3ln]~[.2etl] \\[[>05lmc]\\]: ";
+
+enum class DebugVarType;
+
+/**
+ * The parts of a logger's configuration that can be changed while it logs,
+ * see LoggerConfig
+ * */
+struct LoggerSettings {
+  LoggerSettings() {
+    for (int i = (int)Level::LEVEL_TRACE; i < (int)Level::LEVEL_COUNT; ++i) {
+      prefixFormat[i] = DEFAULT_PREFIX;
+    }
+  }
+
+  Level level = Level::LEVEL_TRACE;
+  bool colorEnabled = true;
+  std::string prefixFormat[(int)Level::LEVEL_COUNT];
+
+  /**
+   * A variable added to every logger of the config, as with addVariable
+   * The value is read on the loggers' threads, so it must outlive them and
+   * be one of the atomic types if it changes
+   * */
+  struct Variable {
+    void *value;
+    DebugVarType type;
+  };
+
+  // a logger's own variable keeps its name over one of these
+  std::map<std::string, Variable> variables;
+
+  // set by LoggerConfig when the settings are published
+  uint64_t version = 0;
+};
+
+/**
+ * Settings shared by any number of loggers, on any threads, and changed
+ * while they log
+ * Published settings are never modified, a change publishes a new copy and
+ * swaps the pointer to it. A logger checks one atomic counter per message
+ * and copies the settings it uses when the counter moves, without taking a
+ * lock
+ *
+ * Old copies are freed once no logger can still be reading them: a logger
+ * marks itself with the current epoch while copying, and a copy retired in
+ * an epoch is freed when every marked logger started in a later one
+ * */
+class LoggerConfig {
+public:
+  static constexpr int MAX_READERS = 256;
+
+  explicit LoggerConfig(const LoggerSettings &settings = LoggerSettings()) {
+    LoggerSettings *first = new LoggerSettings(settings);
+    first->version = 1;
+    current.store(first);
+  }
+
+  /**
+   * Every logger using the config must be gone or detached
+   * */
+  ~LoggerConfig() {
+    delete current.load();
+
+    for (const Retired &old : retired) {
+      delete old.settings;
+    }
+  }
+
+  LoggerConfig(const LoggerConfig &) = delete;
+  LoggerConfig &operator=(const LoggerConfig &) = delete;
+
+  /**
+   * Returns a copy of the settings in use
+   * */
+  LoggerSettings get() const {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    return *current.load();
+  }
+
+  /**
+   * Replaces the settings, loggers pick them up with their next message
+   * */
+  void publish(const LoggerSettings &settings) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    LoggerSettings *next = new LoggerSettings(settings);
+    next->version = current.load()->version + 1;
+
+    const LoggerSettings *old = current.exchange(next);
+    version.store(next->version, std::memory_order_release);
+    retired.push_back({old, epoch.fetch_add(1)});
+    reclaim();
+  }
+
+  /**
+   * Changes a copy of the settings in use and publishes it
+   * config.update([](LoggerSettings &s) { s.level = Level::LEVEL_TRACE; });
+   * */
+  template <typename Change> void update(Change change) {
+    LoggerSettings settings = get();
+    change(settings);
+    publish(settings);
+  }
+
+  /**
+   * Returns the version of the published settings, it grows with every
+   * publish
+   * */
+  uint64_t getVersion() const {
+    return version.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Takes a reader slot for a logger
+   * @return the slot, or -1 if MAX_READERS loggers use the config
+   * */
+  int attach() {
+    for (int i = 0; i < MAX_READERS; ++i) {
+      bool free = false;
+
+      if (readers[i].taken.compare_exchange_strong(free, true)) {
+        return i;
+      }
+    }
+
+    return -1;
+  }
+
+  void detach(int slot) {
+    readers[slot].epoch.store(0);
+    readers[slot].taken.store(false);
+  }
+
+  /**
+   * Returns the published settings, valid until leave is called with the
+   * same slot
+   * */
+  const LoggerSettings *enter(int slot) {
+    readers[slot].epoch.store(epoch.load());
+    return current.load();
+  }
+
+  void leave(int slot) { readers[slot].epoch.store(0); }
+
+private:
+  struct alignas(64) Reader {
+    std::atomic<bool> taken{false};
+
+    // the epoch the reader started in, 0 when it isn't reading
+    std::atomic<uint64_t> epoch{0};
+  };
+
+  struct Retired {
+    const LoggerSettings *settings;
+    uint64_t epoch;
+  };
+
+  /**
+   * Frees the retired settings no reader can be using
+   * */
+  void reclaim() {
+    uint64_t oldestReader = UINT64_MAX;
+
+    for (int i = 0; i < MAX_READERS; ++i) {
+      uint64_t started = readers[i].epoch.load();
+
+      if (started && started < oldestReader) {
+        oldestReader = started;
+      }
+    }
+
+    size_t kept = 0;
+
+    for (const Retired &old : retired) {
+      if (old.epoch < oldestReader) {
+        delete old.settings;
+      } else {
+        retired[kept++] = old;
+      }
+    }
+
+    retired.resize(kept);
+  }
+
+  std::atomic<const LoggerSettings *> current{nullptr};
+  std::atomic<uint64_t> version{1};
+  std::atomic<uint64_t> epoch{1};
+  Reader readers[MAX_READERS];
+
+  mutable std::mutex writeMutex;
+  std::vector<Retired> retired;
+};
+
+/**
+ * Formatting options supplied by the user for a variable or argument
+ * The name and sub-format point back into the format string, so nothing is
+ * copied while parsing
+ * User defined formatters receive it to honor the options that apply to them
+ * */
+struct FormatSpec {
+  // 0 for no change, 1 for upper, 2 for lower
+  int capitalized = CAPITALIZEDFORMAT_NONE;
+  bool rightAligned = false;
+  bool unsignedValue = false;
+  int spaceCount = -1;
+  int spaceCount_dec = -1;
+  bool fillZero = false;
+  int outputFormat = OUTPUTFORMAT_DECIMAL;
+
+  // variable name or argument type
+  const char *nameStart = nullptr, *nameEnd = nullptr;
+
+  // sub-format text, set only when a sub-format was given
+  const char *subFormatStart = nullptr, *subFormatEnd = nullptr;
+
+  std::string_view name() const {
+    return std::string_view(nameStart, nameEnd - nameStart);
+  }
+
+  bool hasSubFormat() const { return subFormatStart != nullptr; }
+};
+
+/**
+ * Specialize to let a type format itself straight into the logger's buffer
+ * Register the specialization with DebugLogger::addFormatter<T>(name), then
+ * pass a pointer to the value for the {name} argument
+ * template <> struct LogFormatter<Point> {
+ *   static void format(LogBuffer &output, const Point &p,
+ *                      const FormatSpec &spec) { ... }
+ * };
+ * */
+template <typename T> struct LogFormatter;
+
 /**
  * all the valid types for debug variables
  * INTEGER32: a 32 bit integer
@@ -53,6 +341,15 @@ enum class Level {
  * FLOAT32: a 32 bit floating point value
  * FLOAT64: a 64 bit floating point value
  * STRING: an instance of std::string
+ * UNSIGNED32: a 32 bit unsigned integer
+ * UNSIGNED64: a 64 bit unsigned integer
+ * BOOL: a bool, printed as true or false
+ * ATOMIC_INTEGER64: a std::atomic<int64_t>
+ * ATOMIC_UNSIGNED64: a std::atomic<uint64_t>
+ * ATOMIC_FLOAT64: a std::atomic<double>
+ * STRING_VIEW: a std::string_view, the text it points to must stay valid
+ * The atomic types are read with relaxed loads, so other threads can update
+ * them while the logger reads them
  * @author Bryce Young 5/19/2021
  * */
 enum class DebugVarType {
@@ -62,6 +359,13 @@ enum class DebugVarType {
   FLOAT32,
   FLOAT64,
   STRING,
+  UNSIGNED32,
+  UNSIGNED64,
+  BOOL,
+  ATOMIC_INTEGER64,
+  ATOMIC_UNSIGNED64,
+  ATOMIC_FLOAT64,
+  STRING_VIEW,
   DEBUGVAR_TYPE_COUNT
 };
 
@@ -75,130 +379,33 @@ enum class DebugVarType {
  * */
 class DebugLogger {
 public:
+  /**
+   * The internal variables, mnemonics and default prefix are shared static
+   * tables, so a logger allocates nothing until it is used
+   * */
   DebugLogger(const std::string &loggerName = "Debug",
               Level level = Level::LEVEL_TRACE)
-      : level(level), targetStream(&std::cout) {
-    this->loggerName = loggerName;
-    totalNanoseconds = 0;
-
-    for (int i = 0; i <= (int)Level::LEVEL_COUNT; ++i) {
-      messageCount[i] = 0;
-    }
-
-    levelNames[(int)Level::LEVEL_TRACE] = "TCE";
-    levelNames[(int)Level::LEVEL_WARNING] = "WNG";
-    levelNames[(int)Level::LEVEL_ERROR] = "ERR";
-    levelNames[(int)Level::CRITICAL_ERROR] = "CRT";
-    levelNames[(int)Level::LEVEL_COUNT] = levelNames[(int)Level::LEVEL_TRACE];
-
-    // add default variables
-    // th = time hours
-    // tm = time minutes
-    // ts = time seconds
-    // tl = time milliseconds
-    // ti = time microseconds
-    addInternalVariable("th", timeVars + 0, DebugVarType::FLOAT64);
-    addInternalVariable("tm", timeVars + 1, DebugVarType::FLOAT64);
-    addInternalVariable("ts", timeVars + 2, DebugVarType::FLOAT64);
-    addInternalVariable("tl", timeVars + 3, DebugVarType::FLOAT64);
-    addInternalVariable("ti", timeVars + 4, DebugVarType::FLOAT64);
-
-    // eth = elapsed time hours
-    // etm = elapsed time minutes
-    // ets = elapsed time seconds
-    // etl = elapsed time milliseconds
-    // eti = elapsed time microseconds
-    addInternalVariable("eth", elapsedTimeVars + 0, DebugVarType::FLOAT64);
-    addInternalVariable("etm", elapsedTimeVars + 1, DebugVarType::FLOAT64);
-    addInternalVariable("ets", elapsedTimeVars + 2, DebugVarType::FLOAT64);
-    addInternalVariable("etl", elapsedTimeVars + 3, DebugVarType::FLOAT64);
-    addInternalVariable("eti", elapsedTimeVars + 4, DebugVarType::FLOAT64);
-
-    // the name of the logger program
-    addInternalVariable("pn", &this->loggerName, DebugVarType::STRING);
-
-    // the name of the levels
-    // tn = trace name
-    // wn = warning name
-    // en = error name
-    // cn = critical name
-    // ln = current level name
-    addInternalVariable("tn", &this->levelNames[(int)Level::LEVEL_TRACE],
-                        DebugVarType::STRING);
-    addInternalVariable("wn", &this->levelNames[(int)Level::LEVEL_WARNING],
-                        DebugVarType::STRING);
-    addInternalVariable("en", &this->levelNames[(int)Level::LEVEL_ERROR],
-                        DebugVarType::STRING);
-    addInternalVariable("cn", &this->levelNames[(int)Level::CRITICAL_ERROR],
-                        DebugVarType::STRING);
-    addInternalVariable("ln", &this->levelNames[(int)Level::LEVEL_COUNT],
-                        DebugVarType::STRING);
-
-    // variables for message count
-    // dmc stands for debug message count
-    addInternalVariable("dmc", &messageCount[(int)Level::LEVEL_COUNT],
-                        DebugVarType::INTEGER64);
-
-    // tmc stands for trace message count
-    // wmc warning message count
-    // emc error message count
-    // cmc critical messageCount
-    addInternalVariable("tmc", &messageCount[(int)Level::LEVEL_TRACE],
-                        DebugVarType::INTEGER64);
-    addInternalVariable("wmc", &messageCount[(int)Level::LEVEL_WARNING],
-                        DebugVarType::INTEGER64);
-    addInternalVariable("emc", &messageCount[(int)Level::LEVEL_ERROR],
-                        DebugVarType::INTEGER64);
-    addInternalVariable("cmc", &messageCount[(int)Level::CRITICAL_ERROR],
-                        DebugVarType::INTEGER64);
-
-    // level message count
-    addInternalVariable("lmc", &currentMessageCount, DebugVarType::INTEGER64);
-
-    // helpful characters
-    addInternalVariable("lbc", &specialCharacters[0], DebugVarType::CHAR);
-    addInternalVariable("rbc", &specialCharacters[1], DebugVarType::CHAR);
-    addInternalVariable("lbk", &specialCharacters[2], DebugVarType::CHAR);
-    addInternalVariable("rbk", &specialCharacters[3], DebugVarType::CHAR);
-    addInternalVariable("bks", &specialCharacters[4], DebugVarType::CHAR);
-
-    // char pnemonics
-    reserves["char"] = Token::TokenType::SIGNED_CHAR;
-    reserves["ch"] = Token::TokenType::SIGNED_CHAR;
-    reserves["c"] = Token::TokenType::SIGNED_CHAR;
-
-    // int pnemonics
-    reserves["int"] = Token::TokenType::SIGNED_INT;
-    reserves["i"] = Token::TokenType::SIGNED_INT;
-    reserves["d"] = Token::TokenType::SIGNED_INT;
-    reserves["uint"] = Token::TokenType::SIGNED_INT;
-    reserves["ui"] = Token::TokenType::SIGNED_INT;
-    reserves["u"] = Token::TokenType::SIGNED_INT;
-
-    // long pneumonics
-    reserves["long"] = Token::TokenType::SIGNED_LONG;
-    reserves["llu"] = Token::TokenType::SIGNED_LONG;
-    reserves["ulong"] = Token::TokenType::SIGNED_LONG;
-    reserves["ul"] = Token::TokenType::SIGNED_LONG;
-
-    // float pnemoinics
-    reserves["float"] = Token::TokenType::FLOAT;
-    reserves["flt"] = Token::TokenType::FLOAT;
-    reserves["f"] = Token::TokenType::FLOAT;
-
-    // str pneumonics
-    reserves["string"] = Token::TokenType::STRING;
-    reserves["str"] = Token::TokenType::STRING;
-    reserves["s"] = Token::TokenType::STRING;
-
-    setPrefix("[3ln]~[.2etl] \\[[>05lmc]\\]: ");
+      : level(level), loggerName(loggerName), targetStream(&std::cout) {
     timer.reset();
+    wallClockBase = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
   }
 
-  ~DebugLogger() {}
+  ~DebugLogger() { setConfig(nullptr); }
 
   void setTargetOutput(std::ostream *outputStream) {
     this->targetStream = outputStream;
+    sinkStream.reset();
+  }
+
+  /**
+   * Writes to a sink instead of a stream, the sink must outlive its use
+   * Colors are written to the sink as well unless they are disabled
+   * */
+  void setTargetSink(LogSink *sink) {
+    sinkStream.reset(new LogSinkStream(*sink));
+    this->targetStream = sinkStream.get();
   }
 
   /**
@@ -206,12 +413,49 @@ public:
    * */
   Level getLevel() const { return level; }
 
+  /**
+   * Returns whether messages on the level are printed
+   * */
+  bool isEnabled(Level lev) const { return this->level <= lev; }
+
   /**
    * Updates level
    * @param newLevel: the new level
    * */
   void setLevel(Level newLevel) { this->level = newLevel; }
 
+  /**
+   * Takes the level, colors and prefixes from a config shared with other
+   * loggers, and follows its changes from then on
+   * The setters still work, until the config publishes its next change
+   * @param newConfig the config, it must outlive its use, nullptr to stop
+   * following it
+   * @return false if the config already has LoggerConfig::MAX_READERS loggers
+   * */
+  bool setConfig(LoggerConfig *newConfig) {
+    if (config) {
+      config->detach(configSlot);
+      config = nullptr;
+      removeConfigVariables();
+    }
+
+    if (!newConfig) {
+      return true;
+    }
+
+    configSlot = newConfig->attach();
+
+    if (configSlot < 0) {
+      return false;
+    }
+
+    config = newConfig;
+    applyConfig();
+    return true;
+  }
+
+  LoggerConfig *getConfig() const { return config; }
+
   void setColorTrace(std::ostream &outputStream) {
     if (enableColor) {
       // outputStream << "\033[34m"; //blue
@@ -264,13 +508,12 @@ public:
   void setPrefix(const std::string &prefix,
                  Level targetLevel = Level::LEVEL_COUNT) {
     if (targetLevel == Level::LEVEL_COUNT) {
-      this->prefixFormat[(int)Level::LEVEL_TRACE] = prefix;
-      this->prefixFormat[(int)Level::LEVEL_WARNING] = prefix;
-      this->prefixFormat[(int)Level::LEVEL_ERROR] = prefix;
-      this->prefixFormat[(int)Level::CRITICAL_ERROR] = prefix;
+      for (int i = (int)Level::LEVEL_TRACE; i < (int)Level::LEVEL_COUNT; ++i) {
+        setPrefixFormat(i, prefix);
+      }
     } else if (targetLevel < Level::LEVEL_COUNT &&
                targetLevel >= Level::LEVEL_TRACE) {
-      this->prefixFormat[(int)targetLevel] = prefix;
+      setPrefixFormat((int)targetLevel, prefix);
     }
   }
 
@@ -283,9 +526,11 @@ public:
     if (updateLogger(Level::LEVEL_TRACE)) {
       setTrace(*this->targetStream);
       ret = logInternal(*this->targetStream, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_TRACE, format, args);
     }
 
-    resetColor(*this->targetStream);
+    finishMessage(*this->targetStream);
 
     va_end(args);
     return ret;
@@ -298,9 +543,11 @@ public:
     if (updateLogger(Level::LEVEL_TRACE)) {
       setTrace(*this->targetStream);
       ret = logInternal(*this->targetStream, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_TRACE, format, args);
     }
 
-    resetColor(*this->targetStream);
+    finishMessage(*this->targetStream);
 
     return ret;
   }
@@ -314,9 +561,11 @@ public:
     if (updateLogger(Level::LEVEL_TRACE)) {
       setTrace(output);
       ret = logInternal(output, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_TRACE, format, args);
     }
 
-    resetColor(output);
+    finishMessage(output);
 
     va_end(args);
     return ret;
@@ -329,9 +578,11 @@ public:
     if (updateLogger(Level::LEVEL_TRACE)) {
       setTrace(output);
       ret = logInternal(output, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_TRACE, format, args);
     }
 
-    resetColor(output);
+    finishMessage(output);
     return ret;
   }
 
@@ -343,9 +594,11 @@ public:
     if (updateLogger(Level::LEVEL_WARNING)) {
       setWarning(*this->targetStream);
       ret = logInternal(*this->targetStream, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_WARNING, format, args);
     }
 
-    resetColor(*this->targetStream);
+    finishMessage(*this->targetStream);
 
     va_end(args);
     return ret;
@@ -357,9 +610,11 @@ public:
     if (updateLogger(Level::LEVEL_WARNING)) {
       setWarning(*this->targetStream);
       ret = logInternal(*this->targetStream, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_WARNING, format, args);
     }
 
-    resetColor(*this->targetStream);
+    finishMessage(*this->targetStream);
 
     return ret;
   }
@@ -372,9 +627,11 @@ public:
     if (updateLogger(Level::LEVEL_WARNING)) {
       setWarning(output);
       ret = logInternal(output, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_WARNING, format, args);
     }
 
-    resetColor(output);
+    finishMessage(output);
 
     va_end(args);
     return ret;
@@ -386,9 +643,11 @@ public:
     if (updateLogger(Level::LEVEL_WARNING)) {
       setWarning(output);
       ret = logInternal(output, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_WARNING, format, args);
     }
 
-    resetColor(output);
+    finishMessage(output);
 
     return ret;
   }
@@ -399,11 +658,14 @@ public:
     va_start(args, format);
 
     if (updateLogger(Level::LEVEL_ERROR)) {
+      writeBacktrace(*this->targetStream);
       setError(*this->targetStream);
       ret = logInternal(*this->targetStream, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_ERROR, format, args);
     }
 
-    resetColor(*this->targetStream);
+    finishMessage(*this->targetStream);
 
     va_end(args);
     return ret;
@@ -413,11 +675,14 @@ public:
     int ret = 0;
 
     if (updateLogger(Level::LEVEL_ERROR)) {
+      writeBacktrace(*this->targetStream);
       setError(*this->targetStream);
       ret = logInternal(*this->targetStream, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_ERROR, format, args);
     }
 
-    resetColor(*this->targetStream);
+    finishMessage(*this->targetStream);
 
     return ret;
   }
@@ -428,11 +693,14 @@ public:
     va_start(args, format);
 
     if (updateLogger(Level::LEVEL_ERROR)) {
+      writeBacktrace(output);
       setError(output);
       ret = logInternal(output, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_ERROR, format, args);
     }
 
-    resetColor(output);
+    finishMessage(output);
 
     va_end(args);
     return ret;
@@ -442,11 +710,14 @@ public:
     int ret = 0;
 
     if (updateLogger(Level::LEVEL_ERROR)) {
+      writeBacktrace(output);
       setError(output);
       ret = logInternal(output, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::LEVEL_ERROR, format, args);
     }
 
-    resetColor(output);
+    finishMessage(output);
 
     return ret;
   }
@@ -457,11 +728,14 @@ public:
     va_start(args, format);
 
     if (updateLogger(Level::CRITICAL_ERROR)) {
+      writeBacktrace(*this->targetStream);
       setCritical(*this->targetStream);
       ret = logInternal(*this->targetStream, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::CRITICAL_ERROR, format, args);
     }
 
-    resetColor(*this->targetStream);
+    finishMessage(*this->targetStream);
 
     va_end(args);
     return ret;
@@ -471,11 +745,14 @@ public:
     int ret = 0;
 
     if (updateLogger(Level::CRITICAL_ERROR)) {
+      writeBacktrace(*this->targetStream);
       setCritical(*this->targetStream);
       ret = logInternal(*this->targetStream, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::CRITICAL_ERROR, format, args);
     }
 
-    resetColor(*this->targetStream);
+    finishMessage(*this->targetStream);
 
     return ret;
   }
@@ -486,11 +763,14 @@ public:
     va_start(args, format);
 
     if (updateLogger(Level::CRITICAL_ERROR)) {
+      writeBacktrace(output);
       setCritical(output);
       ret = logInternal(output, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::CRITICAL_ERROR, format, args);
     }
 
-    resetColor(output);
+    finishMessage(output);
 
     va_end(args);
     return ret;
@@ -501,12 +781,172 @@ public:
     int ret = 0;
 
     if (updateLogger(Level::CRITICAL_ERROR)) {
+      writeBacktrace(output);
       setCritical(output);
       ret = logInternal(output, format, args);
+    } else if (backtrace) {
+      captureBacktrace(Level::CRITICAL_ERROR, format, args);
     }
 
-    resetColor(output);
+    finishMessage(output);
+
+    return ret;
+  }
+
+  /**
+   * Typed front-ends for the functions above
+   * std::string and std::string_view arguments are passed on with their
+   * length for {sv}, so they need no terminator and may contain NULs
+   * Arguments that can be called with no parameters, such as lambdas, are
+   * called only if the level is enabled, or the message is kept by the
+   * backtrace, and their result is printed instead
+   * Arguments are stored with their type rather than passed as C varargs,
+   * see passArg
+   * */
+  template <typename... Args>
+  int trace(const char *format, const Args &...args) {
+    return logTyped(Level::LEVEL_TRACE, nullptr, format, args...);
+  }
+
+  template <typename... Args>
+  int traceToStream(std::ostream &output, const char *format,
+                    const Args &...args) {
+    return logTyped(Level::LEVEL_TRACE, &output, format, args...);
+  }
+
+  template <typename... Args>
+  int warning(const char *format, const Args &...args) {
+    return logTyped(Level::LEVEL_WARNING, nullptr, format, args...);
+  }
+
+  template <typename... Args>
+  int warningToStream(std::ostream &output, const char *format,
+                      const Args &...args) {
+    return logTyped(Level::LEVEL_WARNING, &output, format, args...);
+  }
+
+  template <typename... Args>
+  int error(const char *format, const Args &...args) {
+    return logTyped(Level::LEVEL_ERROR, nullptr, format, args...);
+  }
+
+  template <typename... Args>
+  int errorToStream(std::ostream &output, const char *format,
+                    const Args &...args) {
+    return logTyped(Level::LEVEL_ERROR, &output, format, args...);
+  }
+
+  template <typename... Args>
+  int critical(const char *format, const Args &...args) {
+    return logTyped(Level::CRITICAL_ERROR, nullptr, format, args...);
+  }
+
+  template <typename... Args>
+  int criticalToStream(std::ostream &output, const char *format,
+                       const Args &...args) {
+    return logTyped(Level::CRITICAL_ERROR, &output, format, args...);
+  }
+
+  template <typename... Args>
+  int logToLevel(Level lev, const char *format, const Args &...args) {
+    return logTyped(lev, nullptr, format, args...);
+  }
+
+  /**
+   * Logs on the level whatever the logger's own level is, for callers that
+   * filtered the message already, such as NamedLogger
+   * @param name printed by [lgn] in the prefix
+   * */
+  template <typename... Args>
+  int logNamed(Level lev, std::string_view name, const char *format,
+               const Args &...args) {
+    std::string_view previousName = currentName;
+    currentName = name;
+    levelChecked = true;
+
+    int ret = logTyped(lev, nullptr, format, args...);
+
+    levelChecked = false;
+    currentName = previousName;
+    writeDueLatencyReport();
+    return ret;
+  }
+
+  /**
+   * Counts a message its caller rejected, such as NamedLogger below the
+   * name's level, the same way as a message below the logger's own level:
+   * it shows in the filtered counts and goes to the backtrace
+   * Lazy arguments are only called when the backtrace keeps the message
+   * */
+  template <typename... Args>
+  void logFiltered(Level lev, const char *format, const Args &...args) {
+    if (lev <= Level::NONE || lev >= Level::LEVEL_COUNT) {
+      return;
+    }
+
+    refreshConfig();
+    filteredCount[(int)lev]++;
+    filteredCount[(int)Level::LEVEL_COUNT]++;
+
+    if (backtrace && lev >= backtrace->captureLevel) {
+      captureStored(lev, format, {passArg(evaluateArg(args))...});
+    }
+  }
+
+  /**
+   * Formats a line the way it would be written on the level, prefix
+   * included, without writing or counting it
+   * @return the number of characters appended
+   * */
+  int formatMessage(LogBuffer &output, Level lev, const char *format, ...) {
+    size_t start = output.size();
+    va_list args;
+    va_start(args, format);
+    LogArgs reader(args);
+
+    // the prefix shows the level's name and count, as it would when logging
+    std::string_view levelName = currentLevelName;
+    long long currentCount = currentMessageCount;
+    currentLevelName = LEVEL_NAMES[(int)lev];
+    currentMessageCount = messageCount[(int)lev];
+
+    printPrefix(output, lev, reader);
+    formatInternal(output, format, (int)strlen(format), reader);
+
+    currentLevelName = levelName;
+    currentMessageCount = currentCount;
+
+    va_end(args);
+    return (int)(output.size() - start);
+  }
+
+  /**
+   * Logs the message on the given level
+   * Useful for code which chooses the level at runtime
+   * */
+  int logToLevel(Level lev, const char *format, ...) {
+    int ret = 0;
+    va_list args;
+    va_start(args, format);
+
+    switch (lev) {
+    case Level::LEVEL_TRACE:
+      ret = trace(format, args);
+      break;
+    case Level::LEVEL_WARNING:
+      ret = warning(format, args);
+      break;
+    case Level::LEVEL_ERROR:
+      ret = error(format, args);
+      break;
+    case Level::CRITICAL_ERROR:
+      ret = critical(format, args);
+      break;
+    default:
+      break;
+    }
 
+    va_end(args);
     return ret;
   }
 
@@ -514,7 +954,9 @@ public:
    * Updates times and message counts
    * */
   inline bool updateLogger(Level lev) {
-    if (this->level <= lev) {
+    refreshConfig();
+
+    if (levelChecked || this->level <= lev) {
       messageCount[(int)lev]++;
       messageCount[(int)Level::LEVEL_COUNT]++;
 
@@ -534,138 +976,1030 @@ public:
       elapsedTimeVars[3] = (double)elapsedNanos / 1e6;
       elapsedTimeVars[4] = (double)elapsedNanos / 1000;
 
+      threadId = currentThreadId();
       timer.reset();
       return true;
     }
 
+    filteredCount[(int)lev]++;
+    filteredCount[(int)Level::LEVEL_COUNT]++;
     return false;
   }
 
   inline void setTrace(std::ostream &output) {
     // set trace vars
     setColorTrace(output);
-    levelNames[(int)Level::LEVEL_COUNT] = levelNames[(int)Level::LEVEL_TRACE];
+    currentLevelName = LEVEL_NAMES[(int)Level::LEVEL_TRACE];
     currentMessageCount = messageCount[(int)Level::LEVEL_TRACE];
+    currentLevel = Level::LEVEL_TRACE;
   }
 
   inline void setWarning(std::ostream &output) {
     setColorWarning(output);
-    levelNames[(int)Level::LEVEL_COUNT] = levelNames[(int)Level::LEVEL_WARNING];
+    currentLevelName = LEVEL_NAMES[(int)Level::LEVEL_WARNING];
     currentMessageCount = messageCount[(int)Level::LEVEL_WARNING];
+    currentLevel = Level::LEVEL_WARNING;
   }
 
   inline void setError(std::ostream &output) {
     setColorError(output);
-    levelNames[(int)Level::LEVEL_COUNT] = levelNames[(int)Level::LEVEL_ERROR];
+    currentLevelName = LEVEL_NAMES[(int)Level::LEVEL_ERROR];
     currentMessageCount = messageCount[(int)Level::LEVEL_ERROR];
+    currentLevel = Level::LEVEL_ERROR;
   }
 
   inline void setCritical(std::ostream &output) {
     setColorCritical(output);
-    levelNames[(int)Level::LEVEL_COUNT] =
-        levelNames[(int)Level::CRITICAL_ERROR];
+    currentLevelName = LEVEL_NAMES[(int)Level::CRITICAL_ERROR];
     currentMessageCount = messageCount[(int)Level::CRITICAL_ERROR];
+    currentLevel = Level::CRITICAL_ERROR;
   }
 
   /**
-   * adds a variable to the debugger
-   * @param name the name to which the variable will be referred
-   * @param variable the variable value as a void*
-   * @param type the variable type, one of the section from the enum
-   * @return true if the variable was added successfully, false if the variable
-   * is conflicting with other variables
+   * Struct containing information for a debug var
+   * @author Bryce Young
    * */
-  bool addVariable(const std::string &name, void *variable, DebugVarType type) {
-    // validate variable
-    const char *varName = name.c_str();
-    int index = 0;
-    if (isAlpha(varName, index) || varName[0] == '_') {
-      index++;
+  struct DebugVar {
+  public:
+    DebugVar(DebugVarType type, void *value, bool readOnly = false)
+        : type(type), value(value), readonly(readOnly) {}
 
-      while (varName[index] &&
-             (isAlpha(varName, index) || varName[index] == '_' ||
-              isNum(varName, index))) {
-        index++;
-      }
+    DebugVar(const DebugVar &var)
+        : type(var.type), value(var.value), readonly(var.readonly) {}
 
-      if (index == name.size()) {
-        if (variables.find(name) == variables.end()) {
-          variables.emplace(std::pair<std::string, DebugVar>(
-              {name, DebugVar(type, variable)}));
-          return true;
-        }
-      }
+    DebugVar &operator=(const DebugVar &var) {
+      this->type = var.type;
+      this->value = var.value;
+      this->readonly = var.readonly;
+      return *this;
     }
 
-    // improper var name or something
-    return false;
-  }
+    char getChar() { return *(char *)value; }
 
-  /**
-   * Removes a variable from the list
-   * @param name the name of the variable to remove
-   * @return true if the variable existed and is now removed, false if the
-   * variable never existed
-   * */
-  bool removeVariable(const std::string &name) {
-    std::map<std::string, DebugVar>::iterator v = variables.find(name);
+    float getFloat32() { return *(float *)value; }
 
-    if (v != variables.end() && !v->second.getReadonly()) {
-      variables.erase(v);
+    double getFloat64() { return *(double *)value; }
+
+    int32_t getInt32() { return *(uint32_t *)value; }
+
+    int64_t getInt64() { return *(uint64_t *)value; }
+
+    const char *getString() { return &(*(std::string *)value)[0]; }
+
+    uint32_t getUInt32() { return *(uint32_t *)value; }
+
+    uint64_t getUInt64() { return *(uint64_t *)value; }
+
+    bool getBool() { return *(bool *)value; }
+
+    int64_t getAtomicInt64() {
+      return ((std::atomic<int64_t> *)value)->load(std::memory_order_relaxed);
+    }
+
+    uint64_t getAtomicUInt64() {
+      return ((std::atomic<uint64_t> *)value)->load(std::memory_order_relaxed);
+    }
+
+    double getAtomicFloat64() {
+      return ((std::atomic<double> *)value)->load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the text of a STRING or STRING_VIEW variable with its length
+     * */
+    std::string_view getStringView() {
+      if (type == DebugVarType::STRING) {
+        return *(std::string *)value;
+      }
+
+      return *(std::string_view *)value;
+    }
+
+    DebugVarType getType() const { return type; }
+
+    bool getReadonly() { return readonly; }
+
+  private:
+    DebugVarType type;
+    void *value;
+    bool readonly = false;
+  };
+
+  /**
+   * Looks up a variable by name
+   * @param variable set to the variable when it exists
+   * @return false if the variable doesn't exist
+   * */
+  bool findVariable(std::string_view name, DebugVar &variable) {
+    const InternalVariable *internal = findInternalVariable(name);
+
+    if (internal) {
+      variable = internalVariable(*internal);
       return true;
     }
 
+    if (variables.empty()) {
+      return false;
+    }
+
+    std::map<std::string, DebugVar, std::less<>>::iterator var =
+        variables.find(name);
+
+    if (var == variables.end()) {
+      return false;
+    }
+
+    variable = var->second;
+    return true;
+  }
+
+  /**
+   * adds a variable to the debugger
+   * @param name the name to which the variable will be referred
+   * @param variable the variable value as a void*
+   * @param type the variable type, one of the section from the enum
+   * @return true if the variable was added successfully, false if the variable
+   * is conflicting with other variables
+   * */
+  bool addVariable(const std::string &name, void *variable, DebugVarType type) {
+    // validate variable
+    const char *varName = name.c_str();
+    int index = 0;
+    if (isAlpha(varName, index) || varName[0] == '_') {
+      index++;
+
+      while (varName[index] &&
+             (isAlpha(varName, index) || varName[index] == '_' ||
+              isNum(varName, index))) {
+        index++;
+      }
+
+      if (index == name.size() && !findInternalVariable(name)) {
+        if (variables.find(name) == variables.end()) {
+          variables.emplace(std::pair<std::string, DebugVar>(
+              {name, DebugVar(type, variable)}));
+          return true;
+        }
+      }
+    }
+
+    // improper var name or something
     return false;
   }
 
-private:
   /**
-   * Adds a variable that cannot be removed
+   * Typed versions of addVariable for variables shared between threads
+   * */
+  bool addVariable(const std::string &name, std::atomic<int64_t> *variable) {
+    return addVariable(name, variable, DebugVarType::ATOMIC_INTEGER64);
+  }
+
+  bool addVariable(const std::string &name, std::atomic<uint64_t> *variable) {
+    return addVariable(name, variable, DebugVarType::ATOMIC_UNSIGNED64);
+  }
+
+  bool addVariable(const std::string &name, std::atomic<double> *variable) {
+    return addVariable(name, variable, DebugVarType::ATOMIC_FLOAT64);
+  }
+
+  /**
+   * Function that writes a value straight into the output buffer
+   * Width, alignment and case options are applied to what it writes afterwards
+   * @param output the buffer to append to
+   * @param value the pointer passed as the argument
+   * @param spec the formatting options of the argument
+   * */
+  typedef void (*Formatter)(LogBuffer &output, const void *value,
+                            const FormatSpec &spec);
+
+  /**
+   * Adds an argument type printed by a user function, used as {name} with a
+   * pointer to the value as the argument
+   * @return false if the name is not a valid identifier, is already taken or
+   * is one of the output format modifiers x, X and b
+   * */
+  bool addFormatter(const std::string &name, Formatter formatter) {
+    const char *typeName = name.c_str();
+    int index = 0;
+
+    if (!formatter || !(isAlpha(typeName, index) || typeName[0] == '_')) {
+      return false;
+    }
+
+    while (typeName[index] && (isAlpha(typeName, index) ||
+                               typeName[index] == '_' ||
+                               isNum(typeName, index))) {
+      index++;
+    }
+
+    Token::TokenType taken;
+
+    if (index != (int)name.size() || findReserve(name, taken) ||
+        isOutputFormatModifier(name)) {
+      return false;
+    }
+
+    reserves[name] = Token::TokenType::USER_FORMATTER;
+    formatters[name] = formatter;
+    return true;
+  }
+
+  /**
+   * Adds an argument type printed by the LogFormatter<T> specialization
+   * */
+  template <typename T> bool addFormatter(const std::string &name) {
+    return addFormatter(name, [](LogBuffer &output, const void *value,
+                                 const FormatSpec &spec) {
+      LogFormatter<T>::format(output, *(const T *)value, spec);
+    });
+  }
+
+  /**
+   * Removes an argument type added with addFormatter
    * */
-  bool addInternalVariable(const std::string &name, void *variable,
-                           DebugVarType type) {
-    if (variables.find(name) == variables.end()) {
-      variables.emplace(std::pair<std::string, DebugVar>(
-          {name, DebugVar(type, variable, true)}));
+  bool removeFormatter(const std::string &name) {
+    std::map<std::string, Formatter, std::less<>>::iterator f =
+        formatters.find(name);
+
+    if (f == formatters.end()) {
+      return false;
+    }
+
+    formatters.erase(f);
+    reserves.erase(name);
+    return true;
+  }
+
+  /**
+   * Removes a variable from the list
+   * @param name the name of the variable to remove
+   * @return true if the variable existed and is now removed, false if the
+   * variable never existed
+   * */
+  bool removeVariable(const std::string &name) {
+    std::map<std::string, DebugVar, std::less<>>::iterator v =
+        variables.find(name);
+
+    if (v != variables.end() && !v->second.getReadonly()) {
+      variables.erase(v);
       return true;
     }
 
     return false;
   }
 
+  /**
+   * Sets the most bytes {hex} and {hexdump} print when no precision is given
+   * */
+  void setHexDumpLimit(size_t bytes) { hexDumpLimit = bytes; }
+
+  size_t getHexDumpLimit() const { return hexDumpLimit; }
+
+  /**
+   * Sets the text printed around and between the elements of arrays
+   * */
+  void setArrayFormat(const std::string &separator,
+                      const std::string &open = "[",
+                      const std::string &close = "]") {
+    arraySeparator = separator;
+    arrayOpen = open;
+    arrayClose = close;
+  }
+
+  /**
+   * Sets the most elements printed for each array, the rest are counted
+   * */
+  void setArrayLimit(size_t elements) { arrayLimit = elements; }
+
+  size_t getArrayLimit() const { return arrayLimit; }
+
+  /**
+   * Small number naming the calling thread, 1 for the first thread that asks
+   * and counting up from there. The same for the life of the thread
+   * */
+  static long long currentThreadId() {
+    static std::atomic<long long> nextThreadId{1};
+    thread_local long long id = nextThreadId++;
+    return id;
+  }
+
+  /**
+   * Function called with every line the logger writes, after it is written
+   * @param context the pointer given to setMessageHook
+   * @param lev the level of the message
+   * @param line the formatted line including the prefix and newline
+   * @param length the length of the line
+   * */
+  typedef void (*MessageHook)(void *context, Level lev, const char *line,
+                              size_t length);
+
+  /**
+   * Sets a function to observe every written line, nullptr removes it
+   * */
+  void setMessageHook(MessageHook hook, void *context = nullptr) {
+    messageHook = hook;
+    messageHookContext = context;
+  }
+
+  /**
+   * Keeps messages the level rejects in memory instead of dropping them
+   * The last messages kept are written before the next error or critical
+   * message, giving the trace leading up to a failure without printing it
+   * all the time. Arguments are copied without being formatted, text and
+   * buffers are cut to fit the space of each message
+   * Variables in the kept messages are printed with their values at the time
+   * they are written
+   * @param messages the number of messages kept, older ones are overwritten
+   * @param captureLevel the lowest level that is kept
+   * */
+  void enableBacktrace(size_t messages,
+                       Level captureLevel = Level::LEVEL_TRACE) {
+    if (messages == 0) {
+      disableBacktrace();
+      return;
+    }
+
+    backtrace.reset(new Backtrace(messages));
+    backtrace->captureLevel = captureLevel;
+  }
+
+  void disableBacktrace() { backtrace.reset(); }
+
+  /**
+   * Returns the number of messages waiting in the backtrace
+   * */
+  size_t getBacktraceSize() const { return backtrace ? backtrace->count : 0; }
+
+  /**
+   * Writes the kept messages to the target stream now and empties the
+   * backtrace
+   * */
+  void dumpBacktrace() { writeBacktrace(*this->targetStream); }
+
+  /**
+   * Starts recording the latency of every log call into histograms
+   * One histogram is kept per level (plus one for all levels) for the whole
+   * call, for formatting the line and for writing it to the stream
+   * */
+  void enableLatencyHistograms() {
+    if (!latencyHistograms) {
+      latencyHistograms.reset(new LatencyHistograms());
+    }
+  }
+
+  void disableLatencyHistograms() { latencyHistograms.reset(); }
+
+  bool getLatencyHistogramsEnabled() const { return (bool)latencyHistograms; }
+
+  /**
+   * Returns one of the latency histograms, or nullptr if they are disabled
+   * @param lev the level, Level::LEVEL_COUNT for all levels together
+   * */
+  const LatencyHistogram *getLatencyHistogram(Level lev,
+                                              LatencyPhase phase) const {
+    if (!latencyHistograms || lev < Level::LEVEL_TRACE ||
+        lev > Level::LEVEL_COUNT) {
+      return nullptr;
+    }
+
+    return &latencyHistograms->get((int)lev, phase);
+  }
+
+  /**
+   * Writes p50/p99/p999/max of every level with samples through the logger
+   * @param reportLevel the level the report lines are logged on
+   * */
+  void logLatencyReport(Level reportLevel = Level::LEVEL_TRACE) {
+    if (!latencyHistograms) {
+      return;
+    }
+
+    // take the summaries first so the report doesn't measure itself
+    LatencySummary summaries[(int)Level::LEVEL_COUNT + 1]
+                            [(int)LatencyPhase::PHASE_COUNT];
+
+    for (int l = (int)Level::LEVEL_TRACE; l <= (int)Level::LEVEL_COUNT; ++l) {
+      for (int p = 0; p < (int)LatencyPhase::PHASE_COUNT; ++p) {
+        summaries[l][p] =
+            latencyHistograms->get(l, (LatencyPhase)p).summarize();
+      }
+    }
+
+    const char *phaseNames[] = {"total", "format", "write"};
+
+    for (int l = (int)Level::LEVEL_TRACE; l <= (int)Level::LEVEL_COUNT; ++l) {
+      const char *name =
+          l == (int)Level::LEVEL_COUNT ? "ALL" : LEVEL_NAMES[l].data();
+
+      for (int p = 0; p < (int)LatencyPhase::PHASE_COUNT; ++p) {
+        const LatencySummary &summary = summaries[l][p];
+
+        if (summary.count == 0) {
+          continue;
+        }
+
+        logToLevel(reportLevel,
+                   "latency {str} {6str} count {ulong} p50 {ulong}ns p99 "
+                   "{ulong}ns p999 {ulong}ns max {ulong}ns",
+                   name, phaseNames[p], summary.count, summary.p50,
+                   summary.p99, summary.p999, summary.max);
+      }
+    }
+  }
+
+  /**
+   * Logs the latency report every interval of logger time
+   * @param nanoseconds the time between reports, 0 turns it off
+   * @param reportLevel the level the report lines are logged on
+   * */
+  void setLatencyReportInterval(uint64_t nanoseconds,
+                                Level reportLevel = Level::LEVEL_TRACE) {
+    enableLatencyHistograms();
+    latencyReportInterval = nanoseconds;
+    latencyReportLevel = reportLevel;
+    nextLatencyReport = totalNanoseconds + nanoseconds;
+  }
+
+  /**
+   * Returns a copy of the logger's self-accounting counters
+   * The entry at Level::LEVEL_COUNT holds the totals for all levels
+   * */
+  LoggerStats getStats() const {
+    LoggerStats stats;
+
+    for (int i = 0; i <= (int)Level::LEVEL_COUNT; ++i) {
+      stats.levels[i].messages = messageCount[i];
+      stats.levels[i].filtered = filteredCount[i];
+      stats.levels[i].nanoseconds = logNanoseconds[i];
+      stats.levels[i].bytes = bytesWritten[i];
+      stats.levels[i].bufferGrowths = bufferGrowths[i];
+    }
+
+    return stats;
+  }
+
+private:
+  static constexpr size_t BACKTRACE_MAX_ARGS = 16;
+  static constexpr size_t BACKTRACE_ENTRY_BYTES = 512;
+
+  /**
+   * A message kept by the backtrace, its format and the text and buffers of
+   * its arguments are copied into data
+   * */
+  struct BacktraceEntry {
+    Level level;
+    uint64_t time;
+    const char *format;
+    int formatLength;
+    size_t argCount;
+    size_t used;
+
+    // set when an argument didn't fit, the ones after it weren't kept
+    bool truncated;
+    StoredArg args[BACKTRACE_MAX_ARGS];
+    alignas(8) char data[BACKTRACE_ENTRY_BYTES];
+  };
+
+  /**
+   * Ring of the last messages rejected by the level
+   * */
+  struct Backtrace {
+    Backtrace(size_t messages) : entries(messages) {}
+
+    BacktraceEntry &push() {
+      BacktraceEntry &entry = entries[next];
+      next = (next + 1) % entries.size();
+      count = std::min(count + 1, entries.size());
+      return entry;
+    }
+
+    std::vector<BacktraceEntry> entries;
+    size_t next = 0;
+    size_t count = 0;
+    Level captureLevel = Level::LEVEL_TRACE;
+  };
+
+  /**
+   * Copies the arguments of a rejected message into the next backtrace entry
+   * The format is walked the same way as when printing, but only to learn
+   * the type of each argument
+   * */
+  void captureBacktrace(Level lev, const char *format, va_list &args) {
+    LogArgs reader(args);
+    captureBacktrace(lev, format, reader);
+  }
+
+  void captureBacktrace(Level lev, const char *format, LogArgs &args) {
+    if (lev < backtrace->captureLevel) {
+      return;
+    }
+
+    BacktraceEntry &entry = backtrace->push();
+    entry.level = lev;
+    entry.time = Timer::now();
+    entry.argCount = 0;
+    entry.used = 0;
+    entry.truncated = false;
+
+    size_t formatLength = strlen(format);
+    entry.format = storeBacktraceData(entry, format, formatLength, 1);
+    entry.formatLength = (int)(entry.format ? formatLength : 0);
+
+    if (!entry.format) {
+      return;
+    }
+
+    captureArguments(entry, entry.format, entry.formatLength, args);
+  }
+
+  void captureArguments(BacktraceEntry &entry, const char *format, int len,
+                        LogArgs &args) {
+    int index = 0;
+
+    while (index < len && format[index] && !entry.truncated) {
+      if (format[index] == '\\') {
+        index += format[index + 1] ? 2 : 1;
+        continue;
+      }
+
+      if (format[index] == '[' || format[index] == '{') {
+        FormatSpec spec;
+        collectFormattingOptions(format, index, spec,
+                                 format[index] == '[' ? ']' : '}');
+
+        if (format[index] == ']' && spec.hasSubFormat()) {
+          captureArguments(entry, spec.subFormatStart,
+                           (int)(spec.subFormatEnd - spec.subFormatStart),
+                           args);
+        } else if (format[index] == '}' && spec.nameStart) {
+          captureArgument(entry, spec, args);
+        }
+      }
+
+      index++;
+    }
+  }
+
+  void captureArgument(BacktraceEntry &entry, const FormatSpec &spec,
+                       LogArgs &args) {
+    Token::TokenType argumentType;
+
+    if (!findReserve(spec.name(), argumentType)) {
+      return;
+    }
+
+    StoredArg value = {{0}, 0};
+    StoredArg count = {{0}, 0};
+    bool pair = argumentType == Token::TokenType::HEX_STRING ||
+                argumentType == Token::TokenType::HEX_DUMP ||
+                argumentType == Token::TokenType::INT_ARRAY ||
+                argumentType == Token::TokenType::LONG_ARRAY ||
+                argumentType == Token::TokenType::FLOAT_ARRAY ||
+                argumentType == Token::TokenType::DOUBLE_ARRAY;
+
+    // keeping later arguments without this one would shift them onto the
+    // wrong parameters, so the rest of the message is dropped
+    if (entry.argCount + (pair ? 2 : 1) > BACKTRACE_MAX_ARGS) {
+      entry.truncated = true;
+      return;
+    }
+
+    switch (argumentType) {
+    case Token::TokenType::SIGNED_CHAR:
+      value.integer = (uint64_t)args.nextInt();
+      break;
+    case Token::TokenType::SIGNED_INT:
+      value.integer = args.nextUInt32();
+      break;
+    case Token::TokenType::SIGNED_LONG:
+      value.integer = args.nextUInt64();
+      break;
+    case Token::TokenType::FLOAT:
+      value.real = args.nextDouble();
+      break;
+    case Token::TokenType::STRING: {
+      std::string_view text = args.nextString();
+      value.size = text.size();
+      value.pointer = storeBacktraceText(entry, text.data(), value.size);
+    } break;
+    case Token::TokenType::STRING_VIEW: {
+      std::string_view text = args.nextView();
+      value.size = text.size();
+      value.pointer = storeBacktraceText(entry, text.data(), value.size);
+    } break;
+    case Token::TokenType::HEX_STRING:
+    case Token::TokenType::HEX_DUMP:
+    case Token::TokenType::INT_ARRAY:
+    case Token::TokenType::LONG_ARRAY:
+    case Token::TokenType::FLOAT_ARRAY:
+    case Token::TokenType::DOUBLE_ARRAY: {
+      Token::TokenType type = argumentType;
+      const void *data = args.nextPointer();
+      size_t size = args.nextSize();
+      size_t elementSize =
+          (type == Token::TokenType::INT_ARRAY ||
+           type == Token::TokenType::FLOAT_ARRAY)
+              ? 4
+              : ((type == Token::TokenType::LONG_ARRAY ||
+                  type == Token::TokenType::DOUBLE_ARRAY)
+                     ? 8
+                     : 1);
+      size_t limit = elementSize == 1
+                         ? (spec.spaceCount_dec >= 0
+                                ? (size_t)spec.spaceCount_dec
+                                : hexDumpLimit)
+                         : arrayLimit;
+      size = data ? size : 0;
+
+      // keep as many elements as fit, and the full length so the replayed
+      // line still says how many were left out
+      size_t room = BACKTRACE_ENTRY_BYTES - alignUp(entry.used, 8);
+      size_t kept = std::min(std::min(size, limit), room / elementSize);
+      value.pointer = storeBacktraceData(entry, data, kept * elementSize, 0);
+      count.integer = size;
+      count.size = value.pointer ? kept : 0;
+    } break;
+    case Token::TokenType::USER_FORMATTER: {
+      // the value may be gone by the time it is printed, so keep its text
+      const void *object = args.nextPointer();
+      size_t start = lineBuffer.size();
+      printUserFormatted(lineBuffer, spec, object);
+      value.size = lineBuffer.size() - start;
+      value.pointer =
+          storeBacktraceText(entry, lineBuffer.data() + start, value.size);
+      lineBuffer.truncate(start);
+    } break;
+    default:
+      return;
+    }
+
+    entry.args[entry.argCount++] = value;
+
+    if (pair) {
+      entry.args[entry.argCount++] = count;
+    }
+  }
+
+  static inline size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+  }
+
+  /**
+   * Copies data into the entry, 8 byte aligned
+   * @param terminate the number of NULs written after the data
+   * @return the copy, or nullptr if it doesn't fit
+   * */
+  const char *storeBacktraceData(BacktraceEntry &entry, const void *data,
+                                 size_t size, size_t terminate) {
+    size_t start = alignUp(entry.used, 8);
+
+    if (start + size + terminate > BACKTRACE_ENTRY_BYTES) {
+      return nullptr;
+    }
+
+    char *copy = entry.data + start;
+
+    if (size) {
+      memcpy(copy, data, size);
+    }
+
+    memset(copy + size, 0, terminate);
+    entry.used = start + size + terminate;
+    return copy;
+  }
+
+  /**
+   * Copies text into the entry, cutting it to the space left
+   * @param size the length of the text, set to the length kept
+   * */
+  const char *storeBacktraceText(BacktraceEntry &entry, const char *text,
+                                 size_t &size) {
+    size_t start = alignUp(entry.used, 8);
+
+    if (start >= BACKTRACE_ENTRY_BYTES) {
+      size = 0;
+      return "";
+    }
+
+    size = std::min(size, BACKTRACE_ENTRY_BYTES - start - 1);
+    return storeBacktraceData(entry, text, size, 1);
+  }
+
+  /**
+   * Writes the kept messages, oldest first, each with its level and age
+   * and empties the backtrace
+   * */
+  void writeBacktrace(std::ostream &output) {
+    if (!backtrace || backtrace->count == 0) {
+      return;
+    }
+
+    uint64_t now = Timer::now();
+    size_t capacity = backtrace->entries.size();
+    size_t first = (backtrace->next + capacity - backtrace->count) % capacity;
+    size_t count = backtrace->count;
+
+    // cleared first so messages logged while printing are kept normally
+    backtrace->count = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+      const BacktraceEntry &entry = backtrace->entries[(first + i) % capacity];
+      char age[64];
+      int ageSize = NumberFormat::writeFixed(
+          age, (double)(now - entry.time) / 1e6, 3);
+
+      lineBuffer.clear();
+      lineBuffer.append("backtrace ", 10);
+      lineBuffer.append(LEVEL_NAMES[(int)entry.level].data(),
+                        LEVEL_NAMES[(int)entry.level].size());
+      lineBuffer.append(" -", 2);
+      lineBuffer.append(age, ageSize > 0 ? ageSize : 0);
+      lineBuffer.append("ms: ", 4);
+
+      LogArgs reader(entry.args, entry.argCount, true);
+      formatInternal(lineBuffer, entry.format, entry.formatLength, reader);
+
+      if (entry.truncated) {
+        lineBuffer.append(" (truncated)", 12);
+      }
+
+      lineBuffer.append('\n');
+
+      // entry.format is the slot's own copy, reused by the next capture, and
+      // the caller's string may be gone by now
+      writeLine(output, entry.level, nullptr,
+                wallClockBase + totalNanoseconds - (int64_t)(now - entry.time));
+    }
+  }
+
+  /**
+   * Checks the level before any lazy argument is evaluated
+   * A rejected message is counted and handled the same way as through the
+   * va_list functions, without touching the arguments
+   * */
+  template <typename... Args>
+  int logTyped(Level lev, std::ostream *output, const char *format,
+               const Args &...args) {
+    refreshConfig();
+
+    if (!levelChecked && !isEnabled(lev) &&
+        !(backtrace && lev >= backtrace->captureLevel)) {
+      updateLogger(lev);
+      resetColor(output ? *output : *this->targetStream);
+      return 0;
+    }
+
+    // results of lazy arguments live until the message is written
+    return logStored(lev, output ? *output : *this->targetStream, format,
+                     {passArg(evaluateArg(args))...});
+  }
+
+  /**
+   * Calls lazy arguments, passes the others through as they are
+   * */
+  template <typename T>
+  static inline decltype(auto) evaluateArg(const T &value) {
+    if constexpr (std::is_invocable_v<const T &>) {
+      return value();
+    } else {
+      return (value);
+    }
+  }
+
+  /**
+   * Logs the arguments of the typed front-ends, stored by passArg, the same
+   * way the va_list functions log theirs
+   * */
+  int logStored(Level lev, std::ostream &output, const char *format,
+                std::initializer_list<StoredArg> arguments) {
+    if (lev <= Level::NONE || lev >= Level::LEVEL_COUNT) {
+      return 0;
+    }
+
+    int ret = 0;
+    LogArgs reader(arguments.begin(), arguments.size(), false);
+
+    if (updateLogger(lev)) {
+      switch (lev) {
+      case Level::LEVEL_TRACE:
+        setTrace(output);
+        break;
+      case Level::LEVEL_WARNING:
+        setWarning(output);
+        break;
+      case Level::LEVEL_ERROR:
+        writeBacktrace(output);
+        setError(output);
+        break;
+      default:
+        writeBacktrace(output);
+        setCritical(output);
+        break;
+      }
+
+      ret = logInternal(output, format, reader);
+    } else if (backtrace) {
+      captureBacktrace(lev, format, reader);
+    }
+
+    finishMessage(output);
+    return ret;
+  }
+
+  /**
+   * Keeps the arguments of a rejected typed message in the backtrace
+   * */
+  void captureStored(Level lev, const char *format,
+                     std::initializer_list<StoredArg> arguments) {
+    LogArgs reader(arguments.begin(), arguments.size(), false);
+    captureBacktrace(lev, format, reader);
+  }
+
+  /**
+   * Stores an argument of the typed front-ends by value
+   * Integers are widened to 64 bits, so any integer type can be the count
+   * of a {hex} or array parameter, and std::string and std::string_view
+   * keep their length, which {str} uses as well. Nothing goes through C varargs, which can't carry
+   * class types and need the exact type to be read back
+   * */
+  template <typename T> static inline StoredArg passArg(const T &value) {
+    StoredArg arg = {{0}, 0};
+
+    if constexpr (std::is_floating_point_v<T>) {
+      arg.real = (double)value;
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+      arg.integer = (uint64_t)(int64_t)value;
+    } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+      arg.integer = (uint64_t)value;
+    } else if constexpr (std::is_array_v<T> || std::is_pointer_v<T>) {
+      arg.pointer = (const void *)value;
+      arg.size = StoredArg::NO_SIZE;
+    } else if constexpr (std::is_null_pointer_v<T>) {
+      arg.pointer = nullptr;
+      arg.size = StoredArg::NO_SIZE;
+    } else {
+      static_assert(std::is_pointer_v<T>,
+                    "arguments must be numbers, pointers, strings or "
+                    "callables returning one of those");
+    }
+
+    return arg;
+  }
+
+  static inline StoredArg passArg(const std::string &value) {
+    StoredArg arg = {{0}, value.size()};
+    arg.pointer = value.data();
+    return arg;
+  }
+
+  static inline StoredArg passArg(std::string_view value) {
+    StoredArg arg = {{0}, value.size()};
+    arg.pointer = value.data();
+    return arg;
+  }
+
+  /**
+   * Writes lineBuffer to the output, a sink set with setTargetSink also gets
+   * the level, format and time of the line
+   * */
+  inline void writeLine(std::ostream &output, Level lev, const char *format,
+                        int64_t unixNanoseconds) {
+    if (sinkStream && &output == sinkStream.get()) {
+      LogMessageInfo info = {unixNanoseconds, (int)lev, format};
+      sinkStream->getSink().writeMessage(lineBuffer.data(), lineBuffer.size(),
+                                         info);
+      return;
+    }
+
+    output.write(lineBuffer.data(), (std::streamsize)lineBuffer.size());
+  }
+
   /**
    * Internal method to handle logging
+   * The whole line is formatted into lineBuffer and then written to the
+   * stream at once
    * @param output the output stream to write to
    * @param format the print format
    * @param args the va arguments as a reference
-   * @param level the current log level
    * */
   inline int logInternal(std::ostream &output, const char *format,
-                         va_list &args, bool recursive = false) {
-    std::stringstream outputLine;
+                         va_list &args) {
+    LogArgs reader(args);
+    return logInternal(output, format, reader);
+  }
+
+  inline int logInternal(std::ostream &output, const char *format,
+                         LogArgs &args) {
+    Timer callTimer;
+    uint64_t growthsBefore = lineBuffer.getAllocationCount();
+    lineBuffer.clear();
 
     // print prefix to message using only internal variables
-    if (!recursive) {
-      printPrefix(outputLine, level, args);
+    printPrefix(lineBuffer, currentLevel, args);
+    formatInternal(lineBuffer, format, (int)strlen(format), args);
+    lineBuffer.append('\n');
+
+    uint64_t formatNanoseconds = latencyHistograms ? callTimer.nanoseconds() : 0;
+    writeLine(output, currentLevel, format, wallClockBase + totalNanoseconds);
+    uint64_t totalNanos = callTimer.nanoseconds();
+
+    recordStats(currentLevel, totalNanos, lineBuffer.size(),
+                lineBuffer.getAllocationCount() - growthsBefore);
+
+    int length = (int)lineBuffer.size();
+
+    if (messageHook) {
+      messageHook(messageHookContext, currentLevel, lineBuffer.data(),
+                  lineBuffer.size());
+    }
+
+    if (latencyHistograms) {
+      recordLatency(currentLevel, formatNanoseconds, totalNanos);
+    }
+
+    return length;
+  }
+
+  /**
+   * Records the latency of one call in its level's histograms and the totals
+   * Marks the periodic report due once the interval has passed, it is
+   * written by finishMessage when the call is over
+   * */
+  void recordLatency(Level lev, uint64_t formatNanoseconds,
+                     uint64_t totalNanos) {
+    uint64_t writeNanoseconds = totalNanos - formatNanoseconds;
+    const int levels[2] = {(int)lev, (int)Level::LEVEL_COUNT};
+
+    for (int l : levels) {
+      latencyHistograms->get(l, LatencyPhase::TOTAL).record(totalNanos);
+      latencyHistograms->get(l, LatencyPhase::FORMAT).record(formatNanoseconds);
+      latencyHistograms->get(l, LatencyPhase::WRITE).record(writeNanoseconds);
+    }
+
+    if (latencyReportInterval && !writingLatencyReport &&
+        (uint64_t)totalNanoseconds >= nextLatencyReport) {
+      nextLatencyReport = totalNanoseconds + latencyReportInterval;
+      latencyReportDue = true;
+    }
+  }
+
+  /**
+   * Ends a log call, after the message is written and counted
+   * */
+  inline void finishMessage(std::ostream &output) {
+    resetColor(output);
+
+    // logNamed writes the report once it has restored the logger
+    if (latencyReportDue && !levelChecked) {
+      writeDueLatencyReport();
     }
+  }
 
-    // set color (trace color)
-    int len = (int)strlen(format);
+  /**
+   * Writes the periodic latency report if it came due, its lines are logged
+   * as messages of their own rather than inside the one that made it due
+   * */
+  void writeDueLatencyReport() {
+    if (!latencyReportDue || writingLatencyReport) {
+      return;
+    }
+
+    latencyReportDue = false;
+    writingLatencyReport = true;
+    logLatencyReport(latencyReportLevel);
+    writingLatencyReport = false;
+  }
+
+  /**
+   * Adds the cost of one message to its level and to the totals
+   * */
+  inline void recordStats(Level lev, uint64_t nanoseconds, size_t bytes,
+                          uint64_t growths) {
+    logNanoseconds[(int)lev] += nanoseconds;
+    logNanoseconds[(int)Level::LEVEL_COUNT] += nanoseconds;
+    bytesWritten[(int)lev] += bytes;
+    bytesWritten[(int)Level::LEVEL_COUNT] += bytes;
+    bufferGrowths[(int)lev] += growths;
+    bufferGrowths[(int)Level::LEVEL_COUNT] += growths;
+  }
+
+  /**
+   * Formats the message (or a sub-format) into the buffer
+   * @param output the buffer to append to
+   * @param format the print format
+   * @param len the length of the format
+   * @param args the va arguments as a reference
+   * */
+  inline void formatInternal(LogBuffer &output, const char *format, int len,
+                             LogArgs &args) {
     int formatIndex = 0;
     int previousFormatIndex = -1;
 
     // process and print arguments
-    while (printNext(outputLine, format, formatIndex, args) &&
+    while (printNext(output, format, formatIndex, args) &&
            formatIndex < len && formatIndex != previousFormatIndex) {
       previousFormatIndex = formatIndex;
     }
-
-    if (!recursive) {
-      outputLine << "\n";
-    }
-
-    output << outputLine.str();
-    return (int)outputLine.str().size();
   }
 
   /**
@@ -687,11 +2021,19 @@ private:
       SIGNED_INT,
       SIGNED_LONG,
       STRING,
+      STRING_VIEW,
+      HEX_STRING,
+      HEX_DUMP,
+      INT_ARRAY,
+      LONG_ARRAY,
+      FLOAT_ARRAY,
+      DOUBLE_ARRAY,
       NUMBER,
       DECIMAL,
       HEX_MODIFIER,
       CAPITAL_HEX_MODIFIER,
-      BINARY_MODIFIER
+      BINARY_MODIFIER,
+      USER_FORMATTER
     };
 
     const char *lexemeStart, *lexemeEnd;
@@ -721,6 +2063,14 @@ private:
     return true;
   }
 
+  /**
+   * Returns true for the names the tokenizer reads as output format
+   * modifiers instead of identifiers
+   * */
+  static bool isOutputFormatModifier(std::string_view name) {
+    return name == "x" || name == "X" || name == "b";
+  }
+
   /**
    * Returns if the character can be part of an identifier or not
    * */
@@ -836,9 +2186,6 @@ private:
 
       return true;
     } else if (getIdentifier(format, index)) {
-      // check to see if the identifier was actually a reserve
-      std::string v(currentToken.lexemeStart, currentToken.lexemeEnd);
-
       return true;
     } else {
       // error of some kind
@@ -860,15 +2207,25 @@ private:
     currentToken.lexemeEnd = format + index;
   }
 
+  /**
+   * Parses the number held in the current token
+   * */
+  int tokenNumber() const {
+    int value = 0;
+
+    for (const char *c = currentToken.lexemeStart; c < currentToken.lexemeEnd;
+         ++c) {
+      value = value * 10 + (*c - '0');
+    }
+
+    return value;
+  }
+
   /**
    * Enumerates all formatting options supplied by the user
    * */
   void collectFormattingOptions(const char *format, int &index,
-                                int &capitalized, bool &rightAligned,
-                                bool &unsignedValue, std::string &v,
-                                int &spaceCount, int &spaceCount_dec,
-                                bool &fillZero, int &outputFormat,
-                                std::string &formattedString, char end) {
+                                FormatSpec &spec, char end) {
     bool foundDecimal = false;
 
     // implement variable grammar here
@@ -879,115 +2236,325 @@ private:
       }
 
       if (currentToken.type == Token::TokenType::CAPITAL) {
-        capitalized = CAPITALIZEDFORMAT_CAPS;
+        spec.capitalized = CAPITALIZEDFORMAT_CAPS;
       } else if (currentToken.type == Token::TokenType::LOWER) {
-        capitalized = CAPITALIZEDFORMAT_LOWER;
+        spec.capitalized = CAPITALIZEDFORMAT_LOWER;
       } else if (currentToken.type == Token::TokenType::RIGHT) {
-        rightAligned = true;
+        spec.rightAligned = true;
       } else if (currentToken.type == Token::TokenType::FILL_ZERO) {
-        fillZero = true;
+        spec.fillZero = true;
       } else if (currentToken.type == Token::TokenType::NUMBER) {
-        int value = 0;
-        std::string lexeme(currentToken.lexemeStart, currentToken.lexemeEnd);
-        value = std::stoi(lexeme);
+        int value = tokenNumber();
 
         if (foundDecimal) {
           foundDecimal = false;
-          spaceCount_dec = value;
+          spec.spaceCount_dec = value;
         } else {
-          spaceCount = value;
+          spec.spaceCount = value;
         }
       } else if (currentToken.type == Token::TokenType::ZERO_DECIMALS) {
-        spaceCount_dec = 0;
+        spec.spaceCount_dec = 0;
       } else if (currentToken.type == Token::TokenType::DECIMAL) {
         foundDecimal = true;
       } else if (currentToken.type == Token::TokenType::UNSIGNED_MARK) {
-        unsignedValue = true;
+        spec.unsignedValue = true;
       } else if (currentToken.type == Token::TokenType::HEX_MODIFIER) {
-        outputFormat = OUTPUTFORMAT_HEX;
+        spec.outputFormat = OUTPUTFORMAT_HEX;
       } else if (currentToken.type == Token::TokenType::CAPITAL_HEX_MODIFIER) {
-        outputFormat = OUTPUTFORMAT_UPPERHEX;
+        spec.outputFormat = OUTPUTFORMAT_UPPERHEX;
       } else if (currentToken.type == Token::TokenType::BINARY_MODIFIER) {
-        outputFormat = OUTPUTFORMAT_BIN;
+        spec.outputFormat = OUTPUTFORMAT_BIN;
       } else if (currentToken.type == Token::TokenType::FORMATTED_STRING) {
-        formattedString =
-            std::string(currentToken.lexemeStart, currentToken.lexemeEnd);
-        if (formattedString.size() == 0) {
-          formattedString = " ";
+        static const char emptySubFormat[] = " ";
+
+        if (currentToken.lexemeStart == currentToken.lexemeEnd) {
+          spec.subFormatStart = emptySubFormat;
+          spec.subFormatEnd = emptySubFormat + 1;
+        } else {
+          spec.subFormatStart = currentToken.lexemeStart;
+          spec.subFormatEnd = currentToken.lexemeEnd;
         }
       } else {
-        v = std::string(currentToken.lexemeStart, currentToken.lexemeEnd);
+        spec.nameStart = currentToken.lexemeStart;
+        spec.nameEnd = currentToken.lexemeEnd;
+      }
+
+      skipWhitespace(format, index);
+    }
+  }
+
+  /**
+   * Formats a sub-format in place at the end of the output buffer, then
+   * applies the case and padding options to the region it produced
+   * Right alignment shifts the region over instead of formatting into a
+   * separate buffer, so sub-formats don't allocate at any depth
+   * */
+  void printSubFormat(LogBuffer &output, const FormatSpec &spec,
+                      LogArgs &args) {
+    size_t start = output.size();
+
+    formatInternal(output, spec.subFormatStart,
+                   (int)(spec.subFormatEnd - spec.subFormatStart), args);
+
+    size_t len = output.size() - start;
+
+    if (spec.capitalized != CAPITALIZEDFORMAT_NONE) {
+      char *region = output.data() + start;
+      copyTransformedCase(region, region, len, spec.capitalized);
+    }
+
+    alignRegion(output, start, ' ', spec.rightAligned, spec.spaceCount);
+  }
+
+  /**
+   * Pads the text between start and the end of the buffer to the given width
+   * @param start where the text begins in the output buffer
+   * @param fill the character used for padding
+   * @param right if true, the text is moved right and the padding goes before it
+   * @param space the min number of characters the text takes up
+   * */
+  void alignRegion(LogBuffer &output, size_t start, char fill, bool right,
+                   int space) {
+    size_t len = output.size() - start;
+
+    if (space <= 0 || (size_t)space <= len) {
+      return;
+    }
+
+    size_t fillCount = space - len;
+    output.extend(fillCount);
+
+    char *region = output.data() + start;
+
+    if (right) {
+      memmove(region + fillCount, region, len);
+      memset(region, fill, fillCount);
+    } else {
+      memset(region + len, fill, fillCount);
+    }
+  }
+
+  /**
+   * Prints a memory buffer in hex, either as one run of digits or as a
+   * hexdump with a row per line
+   * Precision caps the number of bytes for this argument, otherwise
+   * hexDumpLimit does, and the number of bytes left out is noted at the end
+   * Width pads the run of digits, or sets the bytes per row of a hexdump
+   * @param available the bytes that can be read, fewer than size for a
+   * buffer the backtrace only kept part of
+   * */
+  void printHexBytes(LogBuffer &output, const FormatSpec &spec,
+                     const uint8_t *bytes, size_t size, bool dump,
+                     size_t available) {
+    size_t limit = spec.spaceCount_dec >= 0 ? (size_t)spec.spaceCount_dec
+                                            : hexDumpLimit;
+    size_t count = std::min(std::min(size, limit), available);
+    bool upper = spec.outputFormat == OUTPUTFORMAT_UPPERHEX ||
+                 spec.capitalized == CAPITALIZEDFORMAT_CAPS;
+    size_t start = output.size();
+
+    if (!bytes) {
+      count = 0;
+    }
+
+    if (dump) {
+      HexFormat::appendHexDump(output, bytes, count,
+                               spec.spaceCount > 0 ? spec.spaceCount : 16,
+                               upper);
+    } else {
+      HexFormat::appendHex(output, bytes, count, upper);
+    }
+
+    if (count < size) {
+      char note[48];
+      int len = snprintf(note, sizeof(note), "%s...(%llu more)",
+                         dump ? "\n" : "", (unsigned long long)(size - count));
+      output.append(note, len);
+    }
+
+    if (!dump) {
+      alignRegion(output, start, ' ', spec.rightAligned, spec.spaceCount);
+    }
+  }
+
+  /**
+   * Prints count elements of an array between the array brackets
+   * The width, alignment and number options apply to each element
+   * Elements past arrayLimit are left out and counted at the end
+   * @param available the elements that can be read, fewer than count for
+   * an array the backtrace only kept part of
+   * */
+  void printArray(LogBuffer &output, const FormatSpec &spec,
+                  Token::TokenType type, bool unsignedType, const void *values,
+                  size_t count, size_t available) {
+    size_t shown = values ? std::min(std::min(count, arrayLimit), available)
+                          : 0;
+
+    // enough for most elements, so the loop doesn't have to grow the buffer
+    size_t elementSize = std::max(spec.spaceCount, 24) + arraySeparator.size();
+    output.reserve(shown * elementSize + arrayOpen.size() + arrayClose.size() +
+                   32);
+    output.append(arrayOpen.data(), arrayOpen.size());
+
+    for (size_t i = 0; i < shown; ++i) {
+      if (i) {
+        output.append(arraySeparator.data(), arraySeparator.size());
+      }
+
+      if (type == Token::TokenType::FLOAT_ARRAY) {
+        printFormattedFloat(output, ((const float *)values)[i],
+                            spec.rightAligned, spec.spaceCount,
+                            spec.spaceCount_dec, spec.fillZero);
+      } else if (type == Token::TokenType::DOUBLE_ARRAY) {
+        printFormattedFloat(output, ((const double *)values)[i],
+                            spec.rightAligned, spec.spaceCount,
+                            spec.spaceCount_dec, spec.fillZero);
+      } else {
+        bool longlong = type == Token::TokenType::LONG_ARRAY;
+        uint64_t value = longlong ? ((const uint64_t *)values)[i]
+                                  : ((const uint32_t *)values)[i];
+        char buffer[129];
+        int len = integerToBuffer(buffer, value, spec.outputFormat,
+                                  unsignedType, longlong);
+        padAndAppend(output, buffer, len, spec.rightAligned, spec.spaceCount,
+                     spec.fillZero ? '0' : ' ');
       }
+    }
 
-      skipWhitespace(format, index);
+    if (shown < count) {
+      char note[48];
+      int len = snprintf(note, sizeof(note), "...(%llu more)",
+                         (unsigned long long)(count - shown));
+
+      if (shown) {
+        output.append(arraySeparator.data(), arraySeparator.size());
+      }
+
+      output.append(note, len);
+    }
+
+    output.append(arrayClose.data(), arrayClose.size());
+  }
+
+  /**
+   * Lets a user formatter write the value, then applies case and padding to
+   * the text it wrote the same way as for sub-formats
+   * */
+  void printUserFormatted(LogBuffer &output, const FormatSpec &spec,
+                          const void *value) {
+    std::map<std::string, Formatter, std::less<>>::iterator f =
+        formatters.find(spec.name());
+
+    if (f == formatters.end()) {
+      return;
     }
+
+    size_t start = output.size();
+    f->second(output, value, spec);
+
+    if (spec.capitalized != CAPITALIZEDFORMAT_NONE) {
+      char *region = output.data() + start;
+      copyTransformedCase(region, region, output.size() - start,
+                          spec.capitalized);
+    }
+
+    alignRegion(output, start, spec.fillZero ? '0' : ' ', spec.rightAligned,
+                spec.spaceCount);
   }
 
   /**
    * Prints the variable
    * */
-  void printVariable(std::ostream &output, const char *format, int &index,
-                     va_list &args) {
-    // 0 for no change, 1 for upper, 2 for lower
-    int capitalized = CAPITALIZEDFORMAT_NONE;
-    bool rightAligned = false;
-    bool unsignedValue = false;
-    std::string variableName;
-    std::string formattedString;
-    int setSpaceCount = -1;
-    int setSpaceCount_dec = -1;
-    bool fillZero = false;
-    int outputFormat = OUTPUTFORMAT_DECIMAL;
-
-    collectFormattingOptions(format, index, capitalized, rightAligned,
-                             unsignedValue, variableName, setSpaceCount,
-                             setSpaceCount_dec, fillZero, outputFormat,
-                             formattedString, ']');
+  void printVariable(LogBuffer &output, const char *format, int &index,
+                     LogArgs &args) {
+    FormatSpec spec;
+    collectFormattingOptions(format, index, spec, ']');
+
+    // if the formatted string specifier is set, it overrides the argument
+    // specifier
+    if (spec.hasSubFormat()) {
+      printSubFormat(output, spec, args);
+      return;
+    }
 
     // now that we have reached the end, we can go ahead and print the variable
     // lets check if it exists first
-    std::map<std::string, DebugVar>::iterator var =
-        variables.find(variableName);
+    if (!spec.nameStart) {
+      return;
+    }
 
-    // if the formatted string specifier is set, it overrides the argument
-    // specifier
-    if (formattedString.size() > 0) {
-      std::stringstream nextOutput;
-
-      logInternal(nextOutput, formattedString.c_str(), args, true);
-      printFormattedString(output, nextOutput.str().c_str(), capitalized,
-                           rightAligned, setSpaceCount);
-    } else if (var != variables.end()) {
-      switch (var->second.getType()) {
+    DebugVar var(DebugVarType::CHAR, nullptr);
+
+    if (findVariable(spec.name(), var)) {
+      switch (var.getType()) {
       case DebugVarType::CHAR: {
-        char value = var->second.getChar();
-        printFormattedChar(output, value, capitalized, rightAligned,
-                           setSpaceCount);
+        char value = var.getChar();
+        printFormattedChar(output, value, spec.capitalized, spec.rightAligned,
+                           spec.spaceCount);
       } break;
       case DebugVarType::INTEGER32: {
-        uint32_t value = var->second.getInt32();
-        printFormattedInteger(output, value, rightAligned, setSpaceCount,
-                              outputFormat, unsignedValue, fillZero, false);
+        uint32_t value = var.getInt32();
+        printFormattedInteger(output, value, spec.rightAligned,
+                              spec.spaceCount, spec.outputFormat,
+                              spec.unsignedValue, spec.fillZero, false);
       } break;
       case DebugVarType::INTEGER64: {
-        uint64_t value = var->second.getInt64();
-        printFormattedInteger(output, value, rightAligned, setSpaceCount,
-                              outputFormat, unsignedValue, fillZero, true);
+        uint64_t value = var.getInt64();
+        printFormattedInteger(output, value, spec.rightAligned,
+                              spec.spaceCount, spec.outputFormat,
+                              spec.unsignedValue, spec.fillZero, true);
       } break;
       case DebugVarType::FLOAT32: {
-        float value = var->second.getFloat32();
-        printFormattedFloat(output, value, rightAligned, setSpaceCount,
-                            setSpaceCount_dec, fillZero);
+        float value = var.getFloat32();
+        printFormattedFloat(output, value, spec.rightAligned, spec.spaceCount,
+                            spec.spaceCount_dec, spec.fillZero);
       } break;
       case DebugVarType::FLOAT64: {
-        double value = var->second.getFloat64();
-        printFormattedFloat(output, value, rightAligned, setSpaceCount,
-                            setSpaceCount_dec, fillZero);
+        double value = var.getFloat64();
+        printFormattedFloat(output, value, spec.rightAligned, spec.spaceCount,
+                            spec.spaceCount_dec, spec.fillZero);
+      } break;
+      case DebugVarType::STRING:
+      case DebugVarType::STRING_VIEW: {
+        std::string_view value = var.getStringView();
+        printFormattedString(output, value.data(), value.size(),
+                             spec.capitalized, spec.rightAligned,
+                             spec.spaceCount);
+      } break;
+      case DebugVarType::UNSIGNED32: {
+        uint32_t value = var.getUInt32();
+        printFormattedInteger(output, value, spec.rightAligned,
+                              spec.spaceCount, spec.outputFormat, true,
+                              spec.fillZero, false);
+      } break;
+      case DebugVarType::UNSIGNED64: {
+        uint64_t value = var.getUInt64();
+        printFormattedInteger(output, value, spec.rightAligned,
+                              spec.spaceCount, spec.outputFormat, true,
+                              spec.fillZero, true);
+      } break;
+      case DebugVarType::BOOL: {
+        std::string_view value = var.getBool() ? "true" : "false";
+        printFormattedString(output, value.data(), value.size(),
+                             spec.capitalized, spec.rightAligned,
+                             spec.spaceCount);
       } break;
-      case DebugVarType::STRING: {
-        const char *value = var->second.getString();
-        printFormattedString(output, value, capitalized, rightAligned,
-                             setSpaceCount);
+      case DebugVarType::ATOMIC_INTEGER64: {
+        uint64_t value = var.getAtomicInt64();
+        printFormattedInteger(output, value, spec.rightAligned,
+                              spec.spaceCount, spec.outputFormat,
+                              spec.unsignedValue, spec.fillZero, true);
+      } break;
+      case DebugVarType::ATOMIC_UNSIGNED64: {
+        uint64_t value = var.getAtomicUInt64();
+        printFormattedInteger(output, value, spec.rightAligned,
+                              spec.spaceCount, spec.outputFormat, true,
+                              spec.fillZero, true);
+      } break;
+      case DebugVarType::ATOMIC_FLOAT64: {
+        double value = var.getAtomicFloat64();
+        printFormattedFloat(output, value, spec.rightAligned, spec.spaceCount,
+                            spec.spaceCount_dec, spec.fillZero);
       } break;
       default:
         break;
@@ -1053,8 +2620,19 @@ private:
 
   double powers10[6] = {10, 100, 1000, 10000, 100000, 1000000};
 
-  void printFormattedFloat(std::ostream &output, double value, bool right,
+  void printFormattedFloat(LogBuffer &output, double value, bool right,
                            int spaces, int decSpaces, bool fillZero) {
+    if (decSpaces <= 64) {
+      char digits[104];
+      int digitsSize = NumberFormat::writeFixed(digits, value, decSpaces);
+
+      if (digitsSize >= 0) {
+        padAndAppend(output, digits, digitsSize, right, spaces,
+                     fillZero ? '0' : ' ');
+        return;
+      }
+    }
+
     decSpaces = (decSpaces == -1) ? 6 : decSpaces;
     int tmpDecSpaces = decSpaces;
     decSpaces = std::max(0, decSpaces);
@@ -1073,221 +2651,276 @@ private:
 
     decSpaces = tmpDecSpaces;
 
-    std::string toPrint(std::to_string(value));
-    int decLoc = (int)toPrint.find('.');
+    // same text std::to_string produces, but kept on the stack
+    // (large enough for the 309 integer digits of DBL_MAX)
+    char toPrint[400];
+    int toPrintSize =
+        std::max(0, snprintf(toPrint, sizeof(toPrint) - 1, "%f", value));
+    toPrintSize = std::min(toPrintSize, (int)sizeof(toPrint) - 2);
+    const char *decimalPoint = (const char *)memchr(toPrint, '.', toPrintSize);
     int len = 0;
 
-    if (decLoc != -1) {
+    if (decimalPoint) {
+      int decLoc = (int)(decimalPoint - toPrint);
       len = decLoc + decSpaces + (decSpaces != 0);
     } else {
       // if the decimal point doesn't exist in the string, there are no decimal
       // places (not relying on std::to_string to add trailing decimals)
-      len = (int)toPrint.size();
+      len = toPrintSize;
 
       if (decSpaces != 0) {
         len += decSpaces + 1;
-        toPrint += '.';
+        toPrint[toPrintSize++] = '.';
       }
     }
 
     // format it right if necessary
+    int fillCount = std::max(0, spaces - len);
+    int printed = std::min(len, toPrintSize);
+    char fill = fillZero ? '0' : ' ';
+
     if (right) {
-      for (int i = 0; i < spaces - len; ++i) {
-        if (fillZero) {
-          output << '0';
-        } else {
-          output << ' ';
-        }
-      }
+      output.fill(fill, fillCount);
+    }
 
-      for (int i = 0; i < len; ++i) {
-        if (i < toPrint.size()) {
-          output << toPrint[i];
-        } else {
-          output << '0';
-        }
-      }
-    } else {
-      for (int i = 0; i < len; ++i) {
-        if (i < toPrint.size()) {
-          output << toPrint[i];
-        } else {
-          output << '0';
-        }
-      }
+    output.append(toPrint, printed);
+    output.fill('0', len - printed);
 
-      for (int i = 0; i < spaces - len; ++i) {
-        if (fillZero) {
-          output << '0';
-        } else {
-          output << ' ';
-        }
-      }
+    if (!right) {
+      output.fill(fill, fillCount);
     }
   }
 
-  void printFormattedStringRaw(std::ostream &output, const char *toPrint,
-                               int cap, int len) {
-    std::string buffer(toPrint, toPrint + len);
+  /**
+   * Changes the case of a single ascii character without branching
+   * Characters outside of a-z (or A-Z when lowering) pass through unchanged
+   * */
+  static inline char transformCase(char c, int cap) {
+    char low = (cap == CAPITALIZEDFORMAT_CAPS) ? 'a' : 'A';
+    unsigned char inRange = (unsigned char)(c - low) <= 'z' - 'a';
+    return (char)(c ^ (inRange << 5));
+  }
+
+  /**
+   * Copies len characters from src to dest changing their case
+   * Works on 16 characters at a time with SSE2, otherwise 8 at a time packed
+   * in a 64 bit integer. Only ascii letters are touched, so bytes of multibyte
+   * characters are copied as they are
+   * */
+  static void copyTransformedCase(char *dest, const char *src, size_t len,
+                                  int cap) {
+    // an empty view may have no data, which memcpy must not be given
+    if (len == 0) {
+      return;
+    }
+
+    if (cap == CAPITALIZEDFORMAT_NONE) {
+      memcpy(dest, src, len);
+      return;
+    }
 
-    for (int i = 0; i < len; ++i) {
-      char next = toPrint[i];
+    char low = (cap == CAPITALIZEDFORMAT_CAPS) ? 'a' : 'A';
+    char high = (cap == CAPITALIZEDFORMAT_CAPS) ? 'z' : 'Z';
+    size_t i = 0;
+
+#ifdef DEBUG_LOGGER_SSE2
+    // bytes above 0x7f compare as negative, so they never fall in range
+    const __m128i belowLow = _mm_set1_epi8((char)(low - 1));
+    const __m128i aboveHigh = _mm_set1_epi8((char)(high + 1));
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+
+    for (; i + 16 <= len; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i mask = _mm_and_si128(_mm_cmpgt_epi8(v, belowLow),
+                                   _mm_cmplt_epi8(v, aboveHigh));
+      v = _mm_xor_si128(v, _mm_and_si128(mask, caseBit));
+      _mm_storeu_si128((__m128i *)(dest + i), v);
+    }
+#endif
 
-      if (cap == CAPITALIZEDFORMAT_CAPS) {
-        next = (char)std::toupper(next);
-      } else if (cap == CAPITALIZEDFORMAT_LOWER) {
-        next = (char)std::tolower(next);
-      }
+    // 8 characters at a time, each byte gets its high bit set when it is in
+    // range, then that bit is shifted down onto the case bit
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t highBits = 0x8080808080808080ull;
+    const uint64_t addLow = ones * (uint64_t)(0x80 - low);
+    const uint64_t addHigh = ones * (uint64_t)(0x80 - (high + 1));
+
+    for (; i + 8 <= len; i += 8) {
+      uint64_t word;
+      memcpy(&word, src + i, 8);
+      uint64_t heptets = word & ~highBits;
+      uint64_t mask =
+          (heptets + addLow) & ~(heptets + addHigh) & ~word & highBits;
+      word ^= mask >> 2;
+      memcpy(dest + i, &word, 8);
+    }
 
-      buffer[i] = next;
+    for (; i < len; ++i) {
+      dest[i] = transformCase(src[i], cap);
     }
+  }
 
-    output << buffer;
+  /**
+   * Writes the characters straight into the output buffer with the case
+   * transform applied
+   * */
+  void printFormattedStringRaw(LogBuffer &output, const char *toPrint,
+                               int cap, size_t len) {
+    copyTransformedCase(output.extend(len), toPrint, len, cap);
   }
 
-  void printFormattedString(std::ostream &output, const char *toPrint, int cap,
-                            bool right, int space) {
-    int len = (int)strlen(toPrint);
+  void printFormattedString(LogBuffer &output, const char *toPrint,
+                            size_t len, int cap, bool right, int space) {
+    size_t fillCount = (space > 0 && (size_t)space > len) ? space - len : 0;
 
     if (right) {
-      for (int i = 0; i < space - len; ++i) {
-        output << ' ';
-      }
-
+      output.fill(' ', fillCount);
       printFormattedStringRaw(output, toPrint, cap, len);
     } else {
       printFormattedStringRaw(output, toPrint, cap, len);
-
-      for (int i = 0; i < space - len; ++i) {
-        output << ' ';
-      }
+      output.fill(' ', fillCount);
     }
   }
 
-  void printFormattedInteger(std::ostream &output, uint64_t value, bool right,
+  void printFormattedInteger(LogBuffer &output, uint64_t value, bool right,
                              int space, int outputFormat, bool unsignedMark,
                              bool fillZero, bool longlong) {
     char buffer[129];
     buffer[128] = 0;
-    int len = 0;
+    int len = integerToBuffer(buffer, value, outputFormat, unsignedMark,
+                              longlong);
+    padAndAppend(output, buffer, len, right, space, fillZero ? '0' : ' ');
+  }
 
-    // print 32 bit integer
+  /**
+   * Writes the digits of an integer in the given base
+   * @param buffer must have room for 128 characters
+   * @return the number of characters written
+   * */
+  int integerToBuffer(char *buffer, uint64_t value, int outputFormat,
+                      bool unsignedMark, bool longlong) {
     if (outputFormat == OUTPUTFORMAT_DECIMAL) {
       if (unsignedMark) {
-        if (longlong) {
-          len = SPRINTF(buffer, "%llu", (unsigned long long int)value);
-        } else {
-          len = SPRINTF(buffer, "%u", (int)value);
-        }
-      } else {
-        if (longlong) {
-          len = SPRINTF(buffer, "%lld", (long long int)value);
-        } else {
-          len = SPRINTF(buffer, "%d", (int)value);
-        }
+        return NumberFormat::writeUnsigned(
+            buffer, longlong ? value : (uint64_t)(uint32_t)value);
       }
+
+      return NumberFormat::writeSigned(
+          buffer, longlong ? (int64_t)value : (int64_t)(int32_t)value);
     } else if (outputFormat == OUTPUTFORMAT_HEX) {
-      len = printHexToBuffer(buffer, value, false);
+      return printHexToBuffer(buffer, value, false);
     } else if (outputFormat == OUTPUTFORMAT_UPPERHEX) {
-      len = printHexToBuffer(buffer, value, true);
+      return printHexToBuffer(buffer, value, true);
     } else if (outputFormat == OUTPUTFORMAT_BIN) {
-      len = printBinToBuffer(buffer, value);
+      return printBinToBuffer(buffer, value);
     }
 
-    if (right) {
-      for (int i = 0; i < space - len; ++i) {
-        if (fillZero) {
-          output << "0";
-        } else {
-          output << " ";
-        }
-      }
+    return 0;
+  }
 
-      output << buffer;
-    } else {
-      output << buffer;
+  /**
+   * Appends the text padded out to space characters with fill
+   * */
+  inline void padAndAppend(LogBuffer &output, const char *text, int len,
+                           bool right, int space, char fill) {
+    int fillCount = std::max(0, space - len);
 
-      for (int i = 0; i < space - len; ++i) {
-        if (fillZero) {
-          output << "0";
-        } else {
-          output << " ";
-        }
-      }
+    if (right) {
+      output.fill(fill, fillCount);
+      output.append(text, len);
+    } else {
+      output.append(text, len);
+      output.fill(fill, fillCount);
     }
   }
 
-  void printFormattedChar(std::ostream &output, char value, int cap, bool right,
+  void printFormattedChar(LogBuffer &output, char value, int cap, bool right,
                           int space) {
-    if (cap == 1) {
-      value = (char)std::toupper(value);
-    } else if (cap == 2) {
-      value = (char)std::tolower(value);
+    if (cap != CAPITALIZEDFORMAT_NONE) {
+      value = transformCase(value, cap);
     }
 
-    if (right) {
-      for (int i = 0; i < space - 1; ++i) {
-        output << " ";
-      }
+    int fillCount = std::max(0, space - 1);
 
-      output << value;
+    if (right) {
+      output.fill(' ', fillCount);
+      output.append(value);
     } else {
-      output << value;
-
-      for (int i = 0; i < space - 1; ++i) {
-        output << " ";
-      }
+      output.append(value);
+      output.fill(' ', fillCount);
     }
   }
 
-  void printArgument(std::ostream &output, const char *format, int &index,
-                     va_list &args) {
-    int capitalized = CAPITALIZEDFORMAT_NONE;
-    bool rightAligned = false;
-    bool unsignedValue = false;
-    std::string type;
-    std::string formattedString;
-    int setSpaceCount = -1;
-    int setSpaceCount_dec = -1;
-    bool fillZero = false;
-    int outputFormat = OUTPUTFORMAT_DECIMAL;
+  void printArgument(LogBuffer &output, const char *format, int &index,
+                     LogArgs &args) {
+    FormatSpec spec;
+    collectFormattingOptions(format, index, spec, '}');
 
-    collectFormattingOptions(format, index, capitalized, rightAligned,
-                             unsignedValue, type, setSpaceCount,
-                             setSpaceCount_dec, fillZero, outputFormat,
-                             formattedString, '}');
+    if (!spec.nameStart) {
+      return;
+    }
 
     // lookup table to determine the variable type
-    std::map<std::string, Token::TokenType>::iterator t = reserves.find(type);
     Token::TokenType argumentType;
 
-    if (t != reserves.end()) {
+    if (findReserve(spec.name(), argumentType)) {
       // its actually a reserve word
-      argumentType = t->second;
+      bool unsignedType = spec.unsignedValue || spec.nameStart[0] == 'u';
 
       if (argumentType == Token::TokenType::SIGNED_CHAR) {
         // collect char from VA args and print
-        char ch = (char)va_arg(args, int);
-        printFormattedChar(output, ch, capitalized, rightAligned,
-                           setSpaceCount);
+        char ch = (char)args.nextInt();
+        printFormattedChar(output, ch, spec.capitalized, spec.rightAligned,
+                           spec.spaceCount);
       } else if (argumentType == Token::TokenType::SIGNED_INT) {
-        uint32_t val = va_arg(args, uint32_t);
-        printFormattedInteger(output, val, rightAligned, setSpaceCount,
-                              outputFormat, unsignedValue || type[0] == 'u',
-                              fillZero, false);
+        uint32_t val = args.nextUInt32();
+        printFormattedInteger(output, val, spec.rightAligned, spec.spaceCount,
+                              spec.outputFormat, unsignedType, spec.fillZero,
+                              false);
       } else if (argumentType == Token::TokenType::SIGNED_LONG) {
-        uint64_t val = va_arg(args, uint64_t);
-        printFormattedInteger(output, val, rightAligned, setSpaceCount,
-                              outputFormat, unsignedValue || type[0] == 'u',
-                              fillZero, true);
+        uint64_t val = args.nextUInt64();
+        printFormattedInteger(output, val, spec.rightAligned, spec.spaceCount,
+                              spec.outputFormat, unsignedType, spec.fillZero,
+                              true);
       } else if (argumentType == Token::TokenType::FLOAT) {
-        double val = va_arg(args, double);
-        printFormattedFloat(output, val, rightAligned, setSpaceCount,
-                            setSpaceCount_dec, fillZero);
+        double val = args.nextDouble();
+        printFormattedFloat(output, val, spec.rightAligned, spec.spaceCount,
+                            spec.spaceCount_dec, spec.fillZero);
       } else if (argumentType == Token::TokenType::STRING) {
-        const char *strValue = (const char *)va_arg(args, void *);
-        printFormattedString(output, strValue, capitalized, rightAligned,
-                             setSpaceCount);
+        std::string_view value = args.nextString();
+        printFormattedString(output, value.data(), value.size(),
+                             spec.capitalized, spec.rightAligned,
+                             spec.spaceCount);
+      } else if (argumentType == Token::TokenType::STRING_VIEW) {
+        std::string_view value = args.nextView();
+        printFormattedString(output, value.data(), value.size(),
+                             spec.capitalized, spec.rightAligned,
+                             spec.spaceCount);
+      } else if (argumentType == Token::TokenType::HEX_STRING ||
+                 argumentType == Token::TokenType::HEX_DUMP) {
+        const uint8_t *bytes = (const uint8_t *)args.nextPointer();
+        size_t available;
+        size_t size = args.nextCount(available);
+        printHexBytes(output, spec, bytes, bytes ? size : 0,
+                      argumentType == Token::TokenType::HEX_DUMP, available);
+      } else if (argumentType == Token::TokenType::INT_ARRAY ||
+                 argumentType == Token::TokenType::LONG_ARRAY ||
+                 argumentType == Token::TokenType::FLOAT_ARRAY ||
+                 argumentType == Token::TokenType::DOUBLE_ARRAY) {
+        const void *values = args.nextPointer();
+        size_t available;
+        size_t count = args.nextCount(available);
+        printArray(output, spec, argumentType, unsignedType, values, count,
+                   available);
+      } else if (argumentType == Token::TokenType::USER_FORMATTER) {
+        if (args.isReplayed()) {
+          // formatted when the message was kept
+          std::string_view text = args.nextView();
+          output.append(text.data(), text.size());
+        } else {
+          const void *value = args.nextPointer();
+          printUserFormatted(output, spec, value);
+        }
       } else {
         // unrecognized type, ignore it
         // an unspecified type is fine, just means we won't have to pull out a
@@ -1307,15 +2940,15 @@ private:
    * @param args the argument list
    * @return true if there is more to the string
    * */
-  bool printNext(std::ostream &outputStream, const char *format, int &index,
-                 va_list &args) {
+  bool printNext(LogBuffer &outputStream, const char *format, int &index,
+                 LogArgs &args) {
     int startIndex = index;
 
     switch (format[index]) {
     case '\\':
       if (format[index + 1]) {
         index++;
-        outputStream << format[index];
+        outputStream.append(format[index]);
       }
       break;
     case '[':
@@ -1330,7 +2963,7 @@ private:
              format[index] != '\\' && format[index]) {
         index++;
       }
-      outputStream << std::string(format + startIndex, format + index);
+      outputStream.append(format + startIndex, index - startIndex);
       index--;
       break;
     }
@@ -1343,15 +2976,15 @@ private:
    * Prints the prefix
    * Pretty much the same thing as printNext, but it will only accept variables
    * */
-  bool printNextPrefix(std::ostream &outputStream, const char *format,
-                       int &index, va_list &args) {
+  bool printNextPrefix(LogBuffer &outputStream, const char *format,
+                       int &index, LogArgs &args) {
     int startIndex = index;
 
     switch (format[index]) {
     case '\\':
       if (format[index + 1]) {
         index++;
-        outputStream << format[index];
+        outputStream.append(format[index]);
       }
       break;
     case '[':
@@ -1363,7 +2996,7 @@ private:
         index++;
       }
 
-      outputStream << std::string(format + startIndex, format + index);
+      outputStream.append(format + startIndex, index - startIndex);
       index--;
       break;
     }
@@ -1372,10 +3005,278 @@ private:
     return format[index];
   }
 
+  /**
+   * Where the value of an internal variable is kept
+   * */
+  enum class InternalSource {
+    TIME,
+    ELAPSED_TIME,
+    PROGRAM_NAME,
+    LEVEL_NAME,
+    CURRENT_LEVEL_NAME,
+    MESSAGE_COUNT,
+    CURRENT_MESSAGE_COUNT,
+    THREAD_ID,
+    LOGGER_NAME,
+    LOG_NANOSECONDS,
+    BYTES_WRITTEN,
+    FILTERED_COUNT,
+    BUFFER_GROWTHS,
+    SPECIAL_CHARACTER,
+    CONTEXT
+  };
+
+  struct InternalVariable {
+    std::string_view name;
+    DebugVarType type;
+    InternalSource source;
+
+    // element of the array the source is, the level for counts
+    int index;
+  };
+
+  struct Mnemonic {
+    std::string_view name;
+    Token::TokenType type;
+  };
+
+  static constexpr std::string_view LEVEL_NAMES[(int)Level::LEVEL_COUNT] = {
+      "", "TCE", "WNG", "ERR", "CRT"};
+
+  /**
+   * Every internal variable, sorted by name for the binary search
+   * th/tm/ts/tl/ti: time in hours, minutes, seconds, milliseconds and
+   * microseconds, eth/etm/ets/etl/eti: the time since the last message
+   * pn: the name of the logger program
+   * tn/wn/en/cn: level names, ln: name of the current level
+   * dmc/tmc/wmc/emc/cmc: message counts, lmc: count on the current level
+   * tid: thread id, see currentThreadId, lgn: name of the NamedLogger
+   * dns/tns/wns/ens/cns: nanoseconds spent logging
+   * dbw/tbw/wbw/ebw/cbw: bytes written
+   * dfc/tfc/wfc/efc/cfc: messages filtered out by the level
+   * dgr/tgr/wgr/egr/cgr: times the line buffer grew while logging
+   * lbc/rbc/lbk/rbk/bks: the characters { } [ ] and backslash
+   * ctx: the LogContext fields of the logging thread
+   * */
+  static constexpr InternalVariable INTERNAL_VARIABLES[] = {
+      {"bks", DebugVarType::CHAR, InternalSource::SPECIAL_CHARACTER, 4},
+      {"cbw", DebugVarType::INTEGER64, InternalSource::BYTES_WRITTEN, 4},
+      {"cfc", DebugVarType::INTEGER64, InternalSource::FILTERED_COUNT, 4},
+      {"cgr", DebugVarType::INTEGER64, InternalSource::BUFFER_GROWTHS, 4},
+      {"cmc", DebugVarType::INTEGER64, InternalSource::MESSAGE_COUNT, 4},
+      {"cn", DebugVarType::STRING_VIEW, InternalSource::LEVEL_NAME, 4},
+      {"cns", DebugVarType::INTEGER64, InternalSource::LOG_NANOSECONDS, 4},
+      {"ctx", DebugVarType::STRING_VIEW, InternalSource::CONTEXT, 0},
+      {"dbw", DebugVarType::INTEGER64, InternalSource::BYTES_WRITTEN, 5},
+      {"dfc", DebugVarType::INTEGER64, InternalSource::FILTERED_COUNT, 5},
+      {"dgr", DebugVarType::INTEGER64, InternalSource::BUFFER_GROWTHS, 5},
+      {"dmc", DebugVarType::INTEGER64, InternalSource::MESSAGE_COUNT, 5},
+      {"dns", DebugVarType::INTEGER64, InternalSource::LOG_NANOSECONDS, 5},
+      {"ebw", DebugVarType::INTEGER64, InternalSource::BYTES_WRITTEN, 3},
+      {"efc", DebugVarType::INTEGER64, InternalSource::FILTERED_COUNT, 3},
+      {"egr", DebugVarType::INTEGER64, InternalSource::BUFFER_GROWTHS, 3},
+      {"emc", DebugVarType::INTEGER64, InternalSource::MESSAGE_COUNT, 3},
+      {"en", DebugVarType::STRING_VIEW, InternalSource::LEVEL_NAME, 3},
+      {"ens", DebugVarType::INTEGER64, InternalSource::LOG_NANOSECONDS, 3},
+      {"eth", DebugVarType::FLOAT64, InternalSource::ELAPSED_TIME, 0},
+      {"eti", DebugVarType::FLOAT64, InternalSource::ELAPSED_TIME, 4},
+      {"etl", DebugVarType::FLOAT64, InternalSource::ELAPSED_TIME, 3},
+      {"etm", DebugVarType::FLOAT64, InternalSource::ELAPSED_TIME, 1},
+      {"ets", DebugVarType::FLOAT64, InternalSource::ELAPSED_TIME, 2},
+      {"lbc", DebugVarType::CHAR, InternalSource::SPECIAL_CHARACTER, 0},
+      {"lbk", DebugVarType::CHAR, InternalSource::SPECIAL_CHARACTER, 2},
+      {"lgn", DebugVarType::STRING_VIEW, InternalSource::LOGGER_NAME, 0},
+      {"lmc", DebugVarType::INTEGER64, InternalSource::CURRENT_MESSAGE_COUNT,
+       0},
+      {"ln", DebugVarType::STRING_VIEW, InternalSource::CURRENT_LEVEL_NAME, 0},
+      {"pn", DebugVarType::STRING, InternalSource::PROGRAM_NAME, 0},
+      {"rbc", DebugVarType::CHAR, InternalSource::SPECIAL_CHARACTER, 1},
+      {"rbk", DebugVarType::CHAR, InternalSource::SPECIAL_CHARACTER, 3},
+      {"tbw", DebugVarType::INTEGER64, InternalSource::BYTES_WRITTEN, 1},
+      {"tfc", DebugVarType::INTEGER64, InternalSource::FILTERED_COUNT, 1},
+      {"tgr", DebugVarType::INTEGER64, InternalSource::BUFFER_GROWTHS, 1},
+      {"th", DebugVarType::FLOAT64, InternalSource::TIME, 0},
+      {"ti", DebugVarType::FLOAT64, InternalSource::TIME, 4},
+      {"tid", DebugVarType::INTEGER64, InternalSource::THREAD_ID, 0},
+      {"tl", DebugVarType::FLOAT64, InternalSource::TIME, 3},
+      {"tm", DebugVarType::FLOAT64, InternalSource::TIME, 1},
+      {"tmc", DebugVarType::INTEGER64, InternalSource::MESSAGE_COUNT, 1},
+      {"tn", DebugVarType::STRING_VIEW, InternalSource::LEVEL_NAME, 1},
+      {"tns", DebugVarType::INTEGER64, InternalSource::LOG_NANOSECONDS, 1},
+      {"ts", DebugVarType::FLOAT64, InternalSource::TIME, 2},
+      {"wbw", DebugVarType::INTEGER64, InternalSource::BYTES_WRITTEN, 2},
+      {"wfc", DebugVarType::INTEGER64, InternalSource::FILTERED_COUNT, 2},
+      {"wgr", DebugVarType::INTEGER64, InternalSource::BUFFER_GROWTHS, 2},
+      {"wmc", DebugVarType::INTEGER64, InternalSource::MESSAGE_COUNT, 2},
+      {"wn", DebugVarType::STRING_VIEW, InternalSource::LEVEL_NAME, 2},
+      {"wns", DebugVarType::INTEGER64, InternalSource::LOG_NANOSECONDS, 2}};
+
+  /**
+   * The built in argument types, sorted by name for the binary search
+   * */
+  static constexpr Mnemonic MNEMONICS[] = {
+      {"c", Token::TokenType::SIGNED_CHAR},
+      {"ch", Token::TokenType::SIGNED_CHAR},
+      {"char", Token::TokenType::SIGNED_CHAR},
+      {"d", Token::TokenType::SIGNED_INT},
+      {"doubles", Token::TokenType::DOUBLE_ARRAY},
+      {"f", Token::TokenType::FLOAT},
+      {"float", Token::TokenType::FLOAT},
+      {"floats", Token::TokenType::FLOAT_ARRAY},
+      {"flt", Token::TokenType::FLOAT},
+      {"hex", Token::TokenType::HEX_STRING},
+      {"hexdump", Token::TokenType::HEX_DUMP},
+      {"i", Token::TokenType::SIGNED_INT},
+      {"int", Token::TokenType::SIGNED_INT},
+      {"ints", Token::TokenType::INT_ARRAY},
+      {"llu", Token::TokenType::SIGNED_LONG},
+      {"long", Token::TokenType::SIGNED_LONG},
+      {"longs", Token::TokenType::LONG_ARRAY},
+      {"s", Token::TokenType::STRING},
+      {"str", Token::TokenType::STRING},
+      {"string", Token::TokenType::STRING},
+      {"sv", Token::TokenType::STRING_VIEW},
+      {"u", Token::TokenType::SIGNED_INT},
+      {"ui", Token::TokenType::SIGNED_INT},
+      {"uint", Token::TokenType::SIGNED_INT},
+      {"uints", Token::TokenType::INT_ARRAY},
+      {"ul", Token::TokenType::SIGNED_LONG},
+      {"ulong", Token::TokenType::SIGNED_LONG},
+      {"ulongs", Token::TokenType::LONG_ARRAY},
+      {"view", Token::TokenType::STRING_VIEW}};
+
+  template <typename T, size_t N>
+  static constexpr bool isSortedByName(const T (&table)[N]) {
+    for (size_t i = 1; i < N; ++i) {
+      if (!(table[i - 1].name < table[i].name)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  /**
+   * Binary search of a table sorted by name
+   * @return the entry or nullptr
+   * */
+  template <typename T, size_t N>
+  static const T *findByName(const T (&table)[N], std::string_view name) {
+    const T *found =
+        std::lower_bound(table, table + N, name,
+                         [](const T &entry, std::string_view key) {
+                           return entry.name < key;
+                         });
+    return found != table + N && found->name == name ? found : nullptr;
+  }
+
+  static const InternalVariable *findInternalVariable(std::string_view name) {
+    static_assert(isSortedByName(INTERNAL_VARIABLES),
+                  "INTERNAL_VARIABLES must be sorted by name");
+    return findByName(INTERNAL_VARIABLES, name);
+  }
+
+  /**
+   * Looks up an argument type, built in or added with addFormatter
+   * */
+  bool findReserve(std::string_view name, Token::TokenType &type) {
+    static_assert(isSortedByName(MNEMONICS), "MNEMONICS must be sorted by name");
+    const Mnemonic *mnemonic = findByName(MNEMONICS, name);
+
+    if (mnemonic) {
+      type = mnemonic->type;
+      return true;
+    }
+
+    if (reserves.empty()) {
+      return false;
+    }
+
+    std::map<std::string, Token::TokenType, std::less<>>::iterator t =
+        reserves.find(name);
+
+    if (t == reserves.end()) {
+      return false;
+    }
+
+    type = t->second;
+    return true;
+  }
+
+  /**
+   * Points an internal variable at this logger's copy of its value
+   * */
+  DebugVar internalVariable(const InternalVariable &variable) {
+    void *value = nullptr;
+
+    switch (variable.source) {
+    case InternalSource::TIME:
+      value = &timeVars[variable.index];
+      break;
+    case InternalSource::ELAPSED_TIME:
+      value = &elapsedTimeVars[variable.index];
+      break;
+    case InternalSource::PROGRAM_NAME:
+      value = &loggerName;
+      break;
+    case InternalSource::LEVEL_NAME:
+      value = (void *)&LEVEL_NAMES[variable.index];
+      break;
+    case InternalSource::CURRENT_LEVEL_NAME:
+      value = &currentLevelName;
+      break;
+    case InternalSource::MESSAGE_COUNT:
+      value = &messageCount[variable.index];
+      break;
+    case InternalSource::CURRENT_MESSAGE_COUNT:
+      value = &currentMessageCount;
+      break;
+    case InternalSource::THREAD_ID:
+      value = &threadId;
+      break;
+    case InternalSource::LOGGER_NAME:
+      value = &currentName;
+      break;
+    case InternalSource::LOG_NANOSECONDS:
+      value = &logNanoseconds[variable.index];
+      break;
+    case InternalSource::BYTES_WRITTEN:
+      value = &bytesWritten[variable.index];
+      break;
+    case InternalSource::FILTERED_COUNT:
+      value = &filteredCount[variable.index];
+      break;
+    case InternalSource::BUFFER_GROWTHS:
+      value = &bufferGrowths[variable.index];
+      break;
+    case InternalSource::SPECIAL_CHARACTER:
+      value = &specialCharacters[variable.index];
+      break;
+    case InternalSource::CONTEXT:
+      // read when it is printed, so only prefixes using it pay for it
+      currentContext = LogContext::text();
+      value = &currentContext;
+      break;
+    }
+
+    return DebugVar(variable.type, value, true);
+  }
+
+  /**
+   * Keeps a copy of a level's prefix and points the level at it
+   * */
+  void setPrefixFormat(int lev, const std::string &format) {
+    prefixFormat[lev] = format;
+    prefix[lev] = prefixFormat[lev];
+  }
+
   // raw values for total time
   double timeVars[5] = {0};
   long long totalNanoseconds = 0;
 
+  // wall clock time when the timer started, in nanoseconds since 1970
+  int64_t wallClockBase = 0;
+
   // raw values for total time
   double elapsedTimeVars[5] = {0};
 
@@ -1384,63 +3285,120 @@ private:
    * messageCount[LEVEL_COUNT] is the total number of messages sent to the
    * debugger
    * */
-  long long messageCount[(int)Level::LEVEL_COUNT + 1];
+  long long messageCount[(int)Level::LEVEL_COUNT + 1] = {0};
   long long currentMessageCount = 0;
 
-  /*
-   * prints to the output stream the debug format
-   */
-  void printPrefix(std::ostream &output, Level level, va_list &args) {
-    const char *format = prefixFormat[(int)level].c_str();
-    int len = (int)prefixFormat[(int)level].size();
-    int formatIndex = 0;
-    int previousFormatIndex = -1;
+  // thread that logged the current message
+  long long threadId = 0;
 
-    // process and print arguments
-    while (printNextPrefix(output, format, formatIndex, args) &&
-           formatIndex < len && formatIndex != previousFormatIndex) {
-      previousFormatIndex = formatIndex;
-    }
-  }
+  /**
+   * The logger's own overhead at each level, the same way as messageCount
+   * logNanoseconds: time spent formatting and writing messages
+   * bytesWritten: bytes of formatted output
+   * filteredCount: messages rejected by the current level
+   * bufferGrowths: times the line buffer grew for a message
+   * */
+  long long logNanoseconds[(int)Level::LEVEL_COUNT + 1] = {0};
+  long long bytesWritten[(int)Level::LEVEL_COUNT + 1] = {0};
+  long long filteredCount[(int)Level::LEVEL_COUNT + 1] = {0};
+  long long bufferGrowths[(int)Level::LEVEL_COUNT + 1] = {0};
+
+  // the level of the message being printed
+  Level currentLevel = Level::LEVEL_TRACE;
 
   /**
-   * Struct containing information for a debug var
-   * @author Bryce Young
+   * Latency histograms for each level and phase, only allocated once enabled
    * */
-  struct DebugVar {
-  public:
-    DebugVar(DebugVarType type, void *value, bool readOnly = false)
-        : type(type), value(value), readonly(readOnly) {}
+  struct LatencyHistograms {
+    LatencyHistogram histograms[(int)Level::LEVEL_COUNT + 1]
+                               [(int)LatencyPhase::PHASE_COUNT];
 
-    DebugVar(const DebugVar &var) : type(var.type), value(var.value) {}
+    LatencyHistogram &get(int lev, LatencyPhase phase) {
+      return histograms[lev][(int)phase];
+    }
+  };
 
-    DebugVar &operator=(const DebugVar &var) {
-      this->type = var.type;
-      this->value = var.value;
-      return *this;
+  std::unique_ptr<LatencyHistograms> latencyHistograms;
+
+  // the periodic latency report, see setLatencyReportInterval
+  uint64_t latencyReportInterval = 0;
+  uint64_t nextLatencyReport = 0;
+  Level latencyReportLevel = Level::LEVEL_TRACE;
+  bool latencyReportDue = false;
+  bool writingLatencyReport = false;
+
+  std::unique_ptr<Backtrace> backtrace;
+
+  // the most bytes printed by {hex} and {hexdump} without a precision
+  size_t hexDumpLimit = 4096;
+
+  // how array parameters are printed
+  std::string arraySeparator = ", ";
+  std::string arrayOpen = "[";
+  std::string arrayClose = "]";
+  size_t arrayLimit = 64;
+
+  // observer of written lines
+  MessageHook messageHook = nullptr;
+  void *messageHookContext = nullptr;
+
+  /**
+   * Copies the settings of the config when it has published new ones
+   * */
+  inline void refreshConfig() {
+    if (config && config->getVersion() != configVersion) {
+      applyConfig();
     }
+  }
 
-    char getChar() { return *(char *)value; }
+  /**
+   * Removes the variables the config added, the logger's own stay
+   * */
+  void removeConfigVariables() {
+    for (const std::string &name : configVariables) {
+      variables.erase(name);
+    }
 
-    float getFloat32() { return *(float *)value; }
+    configVariables.clear();
+  }
 
-    double getFloat64() { return *(double *)value; }
+  void applyConfig() {
+    const LoggerSettings *settings = config->enter(configSlot);
+    level = settings->level;
+    enableColor = settings->colorEnabled;
 
-    int32_t getInt32() { return *(uint32_t *)value; }
+    for (int i = (int)Level::LEVEL_TRACE; i < (int)Level::LEVEL_COUNT; ++i) {
+      setPrefixFormat(i, settings->prefixFormat[i]);
+    }
 
-    int64_t getInt64() { return *(uint64_t *)value; }
+    removeConfigVariables();
 
-    const char *getString() { return &(*(std::string *)value)[0]; }
+    for (const auto &variable : settings->variables) {
+      if (addVariable(variable.first, variable.second.value,
+                      variable.second.type)) {
+        configVariables.push_back(variable.first);
+      }
+    }
 
-    DebugVarType getType() const { return type; }
+    configVersion = settings->version;
+    config->leave(configSlot);
+  }
 
-    bool getReadonly() { return readonly; }
+  /*
+   * prints to the output stream the debug format
+   */
+  void printPrefix(LogBuffer &output, Level level, LogArgs &args) {
+    const char *format = prefix[(int)level].data();
+    int len = (int)prefix[(int)level].size();
+    int formatIndex = 0;
+    int previousFormatIndex = -1;
 
-  private:
-    DebugVarType type;
-    void *value;
-    bool readonly = false;
-  };
+    // process and print arguments
+    while (printNextPrefix(output, format, formatIndex, args) &&
+           formatIndex < len && formatIndex != previousFormatIndex) {
+      previousFormatIndex = formatIndex;
+    }
+  }
 
   bool isNum(const char *format, int &index) {
     return (format[index] >= '0' && format[index] <= '9');
@@ -1470,14 +3428,19 @@ private:
   // special characters as internal variables
   char specialCharacters[6] = "{}[]\\";
 
-  // list of every usable variable
-  std::map<std::string, DebugVar> variables;
+  // variables added with addVariable, the internal ones are in
+  // INTERNAL_VARIABLES
+  std::map<std::string, DebugVar, std::less<>> variables;
+
+  // names of the user defined argument types, the built in ones are in
+  // MNEMONICS
+  std::map<std::string, Token::TokenType, std::less<>> reserves;
 
-  // list of reserves
-  std::map<std::string, Token::TokenType> reserves;
+  // functions for the user defined argument types in reserves
+  std::map<std::string, Formatter, std::less<>> formatters;
 
-  // an array of level names
-  std::string levelNames[(int)Level::LEVEL_COUNT + 1];
+  // name of the level of the message being printed
+  std::string_view currentLevelName = LEVEL_NAMES[(int)Level::LEVEL_TRACE];
 
   /**
    * A string representing the prefix of each debug
@@ -1485,7 +3448,12 @@ private:
    * You can use a different format for each debug level if you want, but you
    * have to specify it with specific function calls Calling the funciton to set
    * the prefix format globally will overwrite it for all level counts!
+   * prefix points at DEFAULT_PREFIX until a level is given its own prefix,
+   * which is kept in prefixFormat
    * */
+  std::string_view prefix[(int)Level::LEVEL_COUNT] = {
+      DEFAULT_PREFIX, DEFAULT_PREFIX, DEFAULT_PREFIX, DEFAULT_PREFIX,
+      DEFAULT_PREFIX};
   std::string prefixFormat[(int)Level::LEVEL_COUNT];
 
   /**
@@ -1502,6 +3470,36 @@ private:
    * The target output stream
    * */
   std::ostream *targetStream;
+
+  /**
+   * Buffer each message is formatted into before being written
+   * */
+  LogBuffer lineBuffer;
+
+  /**
+   * Stream over the sink given to setTargetSink
+   * */
+  std::unique_ptr<LogSinkStream> sinkStream;
+
+  /**
+   * The config given to setConfig, the reader slot it gave this logger and
+   * the version of the settings last copied from it
+   * */
+  LoggerConfig *config = nullptr;
+  int configSlot = -1;
+  uint64_t configVersion = 0;
+
+  // names of the variables added from the config's settings
+  std::vector<std::string> configVariables;
+
+  /**
+   * Set by logNamed for the message being logged
+   * */
+  std::string_view currentName = "";
+  bool levelChecked = false;
+
+  // LogContext fields of the thread, set when [ctx] is looked up
+  std::string_view currentContext;
 };
 
 #endif
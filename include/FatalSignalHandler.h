@@ -0,0 +1,235 @@
+#ifndef INCLUDE_FATAL_SIGNAL_HANDLER_H
+#define INCLUDE_FATAL_SIGNAL_HANDLER_H
+
+#include <atomic>
+#include <cerrno>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "DebugLogger.h"
+#include "LogSink.h"
+
+/**
+ * Writes out buffered log data when the process dies from a fatal signal
+ * Each registered sink is flushed, a critical line naming the signal is
+ * appended, then the previous handler is put back and the signal raised
+ * again so the process still dies (and dumps core) the way it would have
+ * The handler only calls write(), sigaction() and raise()
+ * Lines held in std::ostream buffers can't be written safely from a signal
+ * handler, so only sinks are covered
+ * The handler runs on an alternate signal stack, so a stack overflow is
+ * covered too. The stack is per thread: install gives one to the calling
+ * thread, other threads call installAlternateStack once when they start
+ * POSIX only
+ * */
+class FatalSignalHandler {
+public:
+  static constexpr int MAX_SINKS = 16;
+  static constexpr int MAX_SIGNALS = 8;
+  static constexpr size_t MARKER_SIZE = 512;
+  static constexpr size_t ALTERNATE_STACK_SIZE = 64 * 1024;
+
+  /**
+   * Installs the handler for SIGSEGV, SIGABRT, SIGBUS, SIGFPE and SIGILL
+   * @param logger formats the marker line with its critical prefix, the
+   * prefix variables keep the values they had when this was called
+   * */
+  static bool install(DebugLogger &logger) {
+    static const int defaults[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+    return install(logger, defaults, sizeof(defaults) / sizeof(defaults[0]));
+  }
+
+  static bool install(DebugLogger &logger, const int *signals, int count) {
+    State &s = state();
+    uninstall();
+
+    LogBuffer marker;
+    logger.formatMessage(marker, Level::CRITICAL_ERROR, "fatal signal ");
+    s.markerSize = std::min(marker.size(), MARKER_SIZE);
+    memcpy(s.marker, marker.data(), s.markerSize);
+
+    installAlternateStack();
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &FatalSignalHandler::handle;
+    action.sa_flags = SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+
+    s.signalCount = 0;
+
+    for (int i = 0; i < count && i < MAX_SIGNALS; ++i) {
+      if (sigaction(signals[i], &action, &s.previous[i]) != 0) {
+        uninstall();
+        return false;
+      }
+
+      s.signals[i] = signals[i];
+      s.signalCount = i + 1;
+    }
+
+    return true;
+  }
+
+  /**
+   * Gives the calling thread a stack to handle signals on, so the handler
+   * can still run when the thread's own stack overflowed
+   * A stack the thread already has is kept, the one made here is never freed
+   * @return false if the stack couldn't be allocated or set
+   * */
+  static bool installAlternateStack() {
+    stack_t current;
+
+    if (sigaltstack(nullptr, &current) == 0 &&
+        !(current.ss_flags & SS_DISABLE)) {
+      return true;
+    }
+
+    size_t size = std::max(ALTERNATE_STACK_SIZE, (size_t)SIGSTKSZ);
+    stack_t stack;
+    memset(&stack, 0, sizeof(stack));
+    stack.ss_sp = malloc(size);
+    stack.ss_size = size;
+
+    if (!stack.ss_sp) {
+      return false;
+    }
+
+    if (sigaltstack(&stack, nullptr) != 0) {
+      free(stack.ss_sp);
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * Puts back the handlers that were there before install
+   * */
+  static void uninstall() {
+    State &s = state();
+
+    for (int i = 0; i < s.signalCount; ++i) {
+      sigaction(s.signals[i], &s.previous[i], nullptr);
+    }
+
+    s.signalCount = 0;
+  }
+
+  /**
+   * Adds a sink to flush on a fatal signal, it must be removed before it is
+   * destroyed
+   * @return false if MAX_SINKS are already registered
+   * */
+  static bool addSink(LogSink *sink) {
+    State &s = state();
+
+    for (int i = 0; i < MAX_SINKS; ++i) {
+      LogSink *empty = nullptr;
+
+      if (s.sinks[i].compare_exchange_strong(empty, sink)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  static void removeSink(LogSink *sink) {
+    State &s = state();
+
+    for (int i = 0; i < MAX_SINKS; ++i) {
+      LogSink *current = sink;
+      s.sinks[i].compare_exchange_strong(current, nullptr);
+    }
+  }
+
+private:
+  struct State {
+    std::atomic<LogSink *> sinks[MAX_SINKS] = {};
+    std::atomic<bool> handling{false};
+    char marker[MARKER_SIZE];
+    size_t markerSize = 0;
+    int signals[MAX_SIGNALS];
+    struct sigaction previous[MAX_SIGNALS];
+    int signalCount = 0;
+  };
+
+  static State &state() {
+    static State s;
+    return s;
+  }
+
+  static const char *signalName(int signal) {
+    switch (signal) {
+    case SIGSEGV:
+      return "SIGSEGV";
+    case SIGABRT:
+      return "SIGABRT";
+    case SIGBUS:
+      return "SIGBUS";
+    case SIGFPE:
+      return "SIGFPE";
+    case SIGILL:
+      return "SIGILL";
+    case SIGTERM:
+      return "SIGTERM";
+    case SIGINT:
+      return "SIGINT";
+    default:
+      return "signal";
+    }
+  }
+
+  static void handle(int signal) {
+    State &s = state();
+    int savedErrno = errno;
+
+    // a second fault while flushing goes straight to the previous handler
+    if (!s.handling.exchange(true)) {
+      char line[MARKER_SIZE + 64];
+      size_t size = s.markerSize;
+      memcpy(line, s.marker, size);
+
+      const char *name = signalName(signal);
+      size_t nameSize = strlen(name);
+      memcpy(line + size, name, nameSize);
+      size += nameSize;
+      line[size++] = ' ';
+      line[size++] = '(';
+      size += NumberFormat::writeUnsigned(line + size, (uint64_t)signal);
+      line[size++] = ')';
+      line[size++] = '\n';
+
+      bool wrote = false;
+
+      for (int i = 0; i < MAX_SINKS; ++i) {
+        LogSink *sink = s.sinks[i].load();
+
+        if (sink) {
+          sink->flushFromSignal();
+          sink->writeFromSignal(line, size);
+          wrote = true;
+        }
+      }
+
+      if (!wrote) {
+        ssize_t ignored = ::write(STDERR_FILENO, line, size);
+        (void)ignored;
+      }
+    }
+
+    for (int i = 0; i < s.signalCount; ++i) {
+      if (s.signals[i] == signal) {
+        sigaction(signal, &s.previous[i], nullptr);
+      }
+    }
+
+    errno = savedErrno;
+    raise(signal);
+  }
+};
+
+#endif
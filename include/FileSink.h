@@ -0,0 +1,117 @@
+#ifndef INCLUDE_FILE_SINK_H
+#define INCLUDE_FILE_SINK_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <memory>
+#include <string.h>
+#include <unistd.h>
+
+#include "LogSink.h"
+
+/**
+ * Writes lines to a file descriptor through a fixed size buffer, so most
+ * lines cost a memcpy and the file sees one write() per buffer
+ * The buffer can be written out from a fatal signal handler, which makes
+ * large buffers safe to use together with FatalSignalHandler
+ * POSIX only
+ * */
+class BufferedFileSink : public LogSink {
+public:
+  /**
+   * Opens the file for appending, creating it if needed
+   * */
+  BufferedFileSink(const char *path, size_t bufferSize = 1 << 16)
+      : descriptor(::open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)),
+        ownsDescriptor(true), capacity(bufferSize ? bufferSize : 1),
+        buffer(new char[capacity]), used(0) {}
+
+  /**
+   * Writes to an open descriptor, such as STDOUT_FILENO
+   * @param ownsDescriptor whether the descriptor is closed with the sink
+   * */
+  BufferedFileSink(int descriptor, size_t bufferSize, bool ownsDescriptor)
+      : descriptor(descriptor), ownsDescriptor(ownsDescriptor),
+        capacity(bufferSize ? bufferSize : 1), buffer(new char[capacity]),
+        used(0) {}
+
+  ~BufferedFileSink() {
+    flush();
+
+    if (ownsDescriptor && descriptor >= 0) {
+      ::close(descriptor);
+    }
+  }
+
+  BufferedFileSink(const BufferedFileSink &) = delete;
+  BufferedFileSink &operator=(const BufferedFileSink &) = delete;
+
+  bool isOpen() const { return descriptor >= 0; }
+
+  int getDescriptor() const { return descriptor; }
+
+  void write(const char *data, size_t size) override {
+    size_t current = used.load(std::memory_order_relaxed);
+
+    if (size > capacity - current) {
+      flush();
+      current = 0;
+
+      if (size >= capacity) {
+        writeAll(descriptor, data, size);
+        return;
+      }
+    }
+
+    memcpy(buffer.get() + current, data, size);
+
+    // a signal handler only sees bytes that were completely copied
+    used.store(current + size, std::memory_order_release);
+  }
+
+  void flush() override {
+    writeAll(descriptor, buffer.get(), used.load(std::memory_order_relaxed));
+    used.store(0, std::memory_order_release);
+  }
+
+  void flushFromSignal() override {
+    writeAll(descriptor, buffer.get(),
+             used.exchange(0, std::memory_order_acquire));
+  }
+
+  void writeFromSignal(const char *data, size_t size) override {
+    writeAll(descriptor, data, size);
+  }
+
+  /**
+   * Writes the whole range, retrying after interrupts and short writes
+   * Only calls write(), so it is async-signal-safe
+   * */
+  static void writeAll(int descriptor, const char *data, size_t size) {
+    while (size > 0 && descriptor >= 0) {
+      ssize_t written = ::write(descriptor, data, size);
+
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+
+        return;
+      }
+
+      data += written;
+      size -= (size_t)written;
+    }
+  }
+
+private:
+  int descriptor;
+  bool ownsDescriptor;
+  size_t capacity;
+  std::unique_ptr<char[]> buffer;
+  std::atomic<size_t> used;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef INCLUDE_HEX_FORMAT_H
+#define INCLUDE_HEX_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string.h>
+
+#include "LogBuffer.h"
+#include "Simd.h"
+
+/**
+ * Writes memory buffers as hex straight into a LogBuffer
+ * Sixteen bytes at a time are split into nibbles and turned into digits with
+ * SSE2 where it is available, the tail and other targets use a lookup table
+ * */
+namespace HexFormat {
+
+static const char LOWER_DIGITS[] = "0123456789abcdef";
+static const char UPPER_DIGITS[] = "0123456789ABCDEF";
+
+/**
+ * Writes two hex digits for each of the count bytes
+ * @param out must have room for count * 2 characters
+ * */
+inline void writeHex(char *out, const uint8_t *bytes, size_t count,
+                     bool upper) {
+  size_t i = 0;
+
+#ifdef DEBUG_LOGGER_SSE2
+  const __m128i mask = _mm_set1_epi8(0x0F);
+  const __m128i nine = _mm_set1_epi8(9);
+  const __m128i zero = _mm_set1_epi8('0');
+  const __m128i letterGap = _mm_set1_epi8(upper ? 'A' - '0' - 10 : 'a' - '0' - 10);
+
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+    __m128i high = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+    __m128i low = _mm_and_si128(v, mask);
+
+    // nibbles above 9 skip ahead to the letters
+    high = _mm_add_epi8(_mm_add_epi8(high, zero),
+                        _mm_and_si128(_mm_cmpgt_epi8(high, nine), letterGap));
+    low = _mm_add_epi8(_mm_add_epi8(low, zero),
+                       _mm_and_si128(_mm_cmpgt_epi8(low, nine), letterGap));
+
+    _mm_storeu_si128((__m128i *)(out + i * 2), _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128((__m128i *)(out + i * 2 + 16),
+                     _mm_unpackhi_epi8(high, low));
+  }
+#endif
+
+  const char *digits = upper ? UPPER_DIGITS : LOWER_DIGITS;
+
+  for (; i < count; ++i) {
+    out[i * 2] = digits[bytes[i] >> 4];
+    out[i * 2 + 1] = digits[bytes[i] & 0x0F];
+  }
+}
+
+/**
+ * Copies the bytes, replacing anything that isn't printable ASCII with '.'
+ * */
+inline void writePrintable(char *out, const uint8_t *bytes, size_t count) {
+  size_t i = 0;
+
+#ifdef DEBUG_LOGGER_SSE2
+  const __m128i first = _mm_set1_epi8(0x1F);
+  const __m128i last = _mm_set1_epi8(0x7F);
+  const __m128i dot = _mm_set1_epi8('.');
+
+  for (; i + 16 <= count; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+
+    // signed compares also reject bytes from 0x80 up
+    __m128i printable =
+        _mm_and_si128(_mm_cmpgt_epi8(v, first), _mm_cmplt_epi8(v, last));
+    _mm_storeu_si128((__m128i *)(out + i),
+                     _mm_or_si128(_mm_and_si128(printable, v),
+                                  _mm_andnot_si128(printable, dot)));
+  }
+#endif
+
+  for (; i < count; ++i) {
+    out[i] = (bytes[i] > 0x1F && bytes[i] < 0x7F) ? (char)bytes[i] : '.';
+  }
+}
+
+/**
+ * Appends the bytes as one run of hex digits
+ * */
+inline void appendHex(LogBuffer &output, const uint8_t *bytes, size_t count,
+                      bool upper) {
+  writeHex(output.extend(count * 2), bytes, count, upper);
+}
+
+/**
+ * Appends the bytes in the layout of hexdump -C, each row on a new line:
+ * offset, the bytes in hex split in groups of eight, then the printable text
+ * 00000000  48 65 6c 6c 6f 0a 00 01  02 03 04 05 06 07 08 09  |Hello.........|
+ * @param rowBytes the number of bytes on each row
+ * */
+inline void appendHexDump(LogBuffer &output, const uint8_t *bytes,
+                          size_t count, size_t rowBytes, bool upper) {
+  char digits[2 * 256];
+  char offset[8];
+  rowBytes = rowBytes ? (rowBytes > 256 ? 256 : rowBytes) : 16;
+
+  // offset, two spaces, three characters a byte and a gap between groups,
+  // then the text between bars
+  size_t rowLength = 1 + 8 + 2 + rowBytes * 3 + (rowBytes - 1) / 8 + 1 +
+                     rowBytes + 2;
+
+  for (size_t start = 0; start < count; start += rowBytes) {
+    size_t n = (count - start < rowBytes) ? count - start : rowBytes;
+    char *row = output.extend(rowLength);
+    char *cursor = row;
+
+    *cursor++ = '\n';
+    uint32_t position = (uint32_t)start;
+
+    for (int i = 3; i >= 0; --i) {
+      uint8_t byte = (uint8_t)(position >> (i * 8));
+      writeHex(offset + (3 - i) * 2, &byte, 1, upper);
+    }
+
+    memcpy(cursor, offset, 8);
+    cursor += 8;
+    *cursor++ = ' ';
+    *cursor++ = ' ';
+
+    writeHex(digits, bytes + start, n, upper);
+
+    for (size_t i = 0; i < rowBytes; ++i) {
+      if (i && i % 8 == 0) {
+        *cursor++ = ' ';
+      }
+
+      if (i < n) {
+        cursor[0] = digits[i * 2];
+        cursor[1] = digits[i * 2 + 1];
+      } else {
+        cursor[0] = ' ';
+        cursor[1] = ' ';
+      }
+
+      cursor[2] = ' ';
+      cursor += 3;
+    }
+
+    *cursor++ = ' ';
+    *cursor++ = '|';
+    writePrintable(cursor, bytes + start, n);
+    cursor += n;
+    *cursor++ = '|';
+
+    output.truncate(output.size() - (rowLength - (size_t)(cursor - row)));
+  }
+}
+
+} // namespace HexFormat
+
+#endif
@@ -0,0 +1,498 @@
+#ifndef INCLUDE_INDEXED_FILE_SINK_H
+#define INCLUDE_INDEXED_FILE_SINK_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <memory>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+#include "FileSink.h"
+#include "LogSink.h"
+
+/**
+ * Log file split into blocks, with a side file that describes every block
+ * so a reader can skip the blocks that can't hold what it looks for
+ *
+ * data file:
+ *   "DLI1" magic, 4 reserved bytes
+ *   messages: unix time in nanoseconds (8 bytes), format id (4 bytes),
+ *   line length with the level in the top 4 bits (4 bytes), line text
+ * index file (data file name + ".idx"):
+ *   "DLX1" magic, entry size (4 bytes)
+ *   entries, one per block of messages:
+ *     data offset (8), data size (4), message count (4),
+ *     first and last unix time in nanoseconds (8 + 8), level bit mask (4),
+ *     reserved (4), filter of the format ids (FORMAT_FILTER_BYTES)
+ * All integers are little endian
+ * A block's entry is written after its data, a data file that is longer
+ * than its index ends in a block without an entry
+ * */
+namespace IndexedLogFormat {
+constexpr char DATA_MAGIC[4] = {'D', 'L', 'I', '1'};
+constexpr char INDEX_MAGIC[4] = {'D', 'L', 'X', '1'};
+constexpr size_t DATA_HEADER_SIZE = 8;
+constexpr size_t INDEX_HEADER_SIZE = 8;
+constexpr size_t MESSAGE_HEADER_SIZE = 16;
+constexpr size_t FORMAT_FILTER_BYTES = 24;
+constexpr size_t ENTRY_SIZE = 40 + FORMAT_FILTER_BYTES;
+constexpr uint32_t LENGTH_MASK = 0x0FFFFFFF;
+constexpr int LEVEL_SHIFT = 28;
+
+/**
+ * Id of a format string, the same in every run of the program
+ * Text written to the sink through a stream has format id 0
+ * */
+inline uint32_t formatId(const char *format) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+
+  for (; *format; ++format) {
+    hash = (hash ^ (unsigned char)*format) * 16777619u;
+  }
+
+  return hash ? hash : 1;
+}
+
+template <typename T> inline T read(const char *data) {
+  static_assert(std::is_integral_v<T>, "only integers are stored");
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    value |= (uint64_t)(unsigned char)data[i] << (i * 8);
+  }
+
+  return (T)value;
+}
+
+template <typename T> inline void write(char *data, T value) {
+  static_assert(std::is_integral_v<T>, "only integers are stored");
+
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    data[i] = (char)((uint64_t)value >> (i * 8));
+  }
+}
+
+/**
+ * Summary of a block of messages, as stored in the index
+ * */
+struct BlockInfo {
+  uint64_t offset = 0;
+  uint32_t size = 0;
+  uint32_t messageCount = 0;
+  int64_t firstNanoseconds = INT64_MAX;
+  int64_t lastNanoseconds = INT64_MIN;
+  uint32_t levelMask = 0;
+  uint8_t formats[FORMAT_FILTER_BYTES] = {0};
+
+  void add(int64_t unixNanoseconds, int level, uint32_t id) {
+    messageCount++;
+    firstNanoseconds = std::min(firstNanoseconds, unixNanoseconds);
+    lastNanoseconds = std::max(lastNanoseconds, unixNanoseconds);
+    levelMask |= 1u << level;
+
+    const uint32_t bits = FORMAT_FILTER_BYTES * 8;
+    formats[(id % bits) / 8] |= (uint8_t)(1 << (id % 8));
+    formats[((id / bits) % bits) / 8] |= (uint8_t)(1 << ((id / bits) % 8));
+  }
+
+  /**
+   * @return false if no message of the block has the format
+   * */
+  bool mayContainFormat(uint32_t id) const {
+    const uint32_t bits = FORMAT_FILTER_BYTES * 8;
+    return (formats[(id % bits) / 8] & (1 << (id % 8))) &&
+           (formats[((id / bits) % bits) / 8] & (1 << ((id / bits) % 8)));
+  }
+
+  void encode(char *entry) const {
+    write(entry, offset);
+    write(entry + 8, size);
+    write(entry + 12, messageCount);
+    write(entry + 16, firstNanoseconds);
+    write(entry + 24, lastNanoseconds);
+    write(entry + 32, levelMask);
+    write(entry + 36, (uint32_t)0);
+    memcpy(entry + 40, formats, FORMAT_FILTER_BYTES);
+  }
+
+  void decode(const char *entry) {
+    offset = read<uint64_t>(entry);
+    size = read<uint32_t>(entry + 8);
+    messageCount = read<uint32_t>(entry + 12);
+    firstNanoseconds = read<int64_t>(entry + 16);
+    lastNanoseconds = read<int64_t>(entry + 24);
+    levelMask = read<uint32_t>(entry + 32);
+    memcpy(formats, entry + 40, FORMAT_FILTER_BYTES);
+  }
+};
+
+/**
+ * One message read back from a block
+ * */
+struct Message {
+  int64_t unixNanoseconds;
+  uint32_t formatId;
+  int level;
+  const char *text;
+  size_t size;
+};
+
+/**
+ * Calls onMessage(const Message &) for every message in the block data
+ * @return false if the data ends in the middle of a message
+ * */
+template <typename F>
+inline bool forEachMessage(const char *data, size_t size, F &&onMessage) {
+  size_t position = 0;
+
+  while (size - position >= MESSAGE_HEADER_SIZE) {
+    const char *header = data + position;
+    uint32_t lengthAndLevel = read<uint32_t>(header + 12);
+    size_t length = lengthAndLevel & LENGTH_MASK;
+
+    if (length > size - position - MESSAGE_HEADER_SIZE) {
+      return false;
+    }
+
+    Message message = {read<int64_t>(header), read<uint32_t>(header + 8),
+                       (int)(lengthAndLevel >> LEVEL_SHIFT),
+                       header + MESSAGE_HEADER_SIZE, length};
+    onMessage(message);
+    position += MESSAGE_HEADER_SIZE + length;
+  }
+
+  return position == size;
+}
+} // namespace IndexedLogFormat
+
+/**
+ * Writes messages in blocks with their time, level and format id, and a
+ * side index of the blocks, see IndexedLogFormat for the layout
+ * Query the files with IndexedLogReader or DebugLoggerQuery, which only read
+ * the blocks the index says can match
+ * Needs setTargetSink for the message details, text written to the sink
+ * through a stream is kept with level 0 and format id 0
+ * A block can be written out from a fatal signal handler
+ * POSIX only
+ * */
+class IndexedFileSink : public LogSink {
+public:
+  /**
+   * Creates path and path + ".idx", replacing earlier files
+   * @param blockSize the most data in a block, a smaller block means a finer
+   * index and a bigger index file
+   * */
+  IndexedFileSink(const char *path, size_t blockSize = 1 << 16)
+      : dataDescriptor(::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+        indexDescriptor(::open((std::string(path) + ".idx").c_str(),
+                               O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+        capacity(blockSize > IndexedLogFormat::MESSAGE_HEADER_SIZE
+                     ? blockSize
+                     : IndexedLogFormat::MESSAGE_HEADER_SIZE + 1),
+        buffer(new char[capacity]), used(0) {
+    char header[IndexedLogFormat::DATA_HEADER_SIZE] = {0};
+    memcpy(header, IndexedLogFormat::DATA_MAGIC, 4);
+    BufferedFileSink::writeAll(dataDescriptor, header, sizeof(header));
+
+    memcpy(header, IndexedLogFormat::INDEX_MAGIC, 4);
+    IndexedLogFormat::write(header + 4, (uint32_t)IndexedLogFormat::ENTRY_SIZE);
+    BufferedFileSink::writeAll(indexDescriptor, header, sizeof(header));
+  }
+
+  ~IndexedFileSink() {
+    flush();
+
+    if (dataDescriptor >= 0) {
+      ::close(dataDescriptor);
+    }
+
+    if (indexDescriptor >= 0) {
+      ::close(indexDescriptor);
+    }
+  }
+
+  IndexedFileSink(const IndexedFileSink &) = delete;
+  IndexedFileSink &operator=(const IndexedFileSink &) = delete;
+
+  bool isOpen() const { return dataDescriptor >= 0 && indexDescriptor >= 0; }
+
+  void write(const char *data, size_t size) override {
+    LogMessageInfo info = {lastNanoseconds, 0, nullptr};
+    writeMessage(data, size, info);
+  }
+
+  void writeMessage(const char *data, size_t size,
+                    const LogMessageInfo &info) override {
+    size = std::min(size, (size_t)IndexedLogFormat::LENGTH_MASK);
+    size_t recordSize = IndexedLogFormat::MESSAGE_HEADER_SIZE + size;
+    size_t current = used.load(std::memory_order_relaxed);
+
+    if (recordSize > capacity - current && current > 0) {
+      flush();
+      current = 0;
+    }
+
+    char header[IndexedLogFormat::MESSAGE_HEADER_SIZE];
+    uint32_t id = info.format ? cachedFormatId(info.format) : 0;
+    encodeHeader(header, info.unixNanoseconds, id, info.level, size);
+    block.add(info.unixNanoseconds, info.level, id);
+    lastNanoseconds = info.unixNanoseconds;
+
+    // a message bigger than a block is a block of its own
+    if (recordSize > capacity) {
+      block.offset = dataEnd();
+      BufferedFileSink::writeAll(dataDescriptor, header, sizeof(header));
+      BufferedFileSink::writeAll(dataDescriptor, data, size);
+      block.size = (uint32_t)recordSize;
+      writeIndexEntry(block);
+      block = IndexedLogFormat::BlockInfo();
+      return;
+    }
+
+    memcpy(buffer.get() + current, header, sizeof(header));
+    memcpy(buffer.get() + current + sizeof(header), data, size);
+
+    // a signal handler only sees messages that were completely copied
+    used.store(current + recordSize, std::memory_order_release);
+  }
+
+  /**
+   * Ends the current block, writing it and its index entry
+   * */
+  void flush() override {
+    size_t size = used.load(std::memory_order_relaxed);
+
+    if (size > 0) {
+      block.offset = dataEnd();
+      BufferedFileSink::writeAll(dataDescriptor, buffer.get(), size);
+      block.size = (uint32_t)size;
+      writeIndexEntry(block);
+      block = IndexedLogFormat::BlockInfo();
+    }
+
+    used.store(0, std::memory_order_release);
+  }
+
+  /**
+   * Writes the completely copied messages of the current block with an entry
+   * built from their headers, the signal may have interrupted writeMessage
+   * while it was updating the block's entry
+   * */
+  void flushFromSignal() override {
+    size_t size = used.exchange(0, std::memory_order_acquire);
+
+    if (size > 0) {
+      IndexedLogFormat::BlockInfo entry;
+      IndexedLogFormat::forEachMessage(
+          buffer.get(), size, [&](const IndexedLogFormat::Message &message) {
+            entry.add(message.unixNanoseconds, message.level,
+                      message.formatId);
+          });
+      writeFromSignalBlock(entry, buffer.get(), size);
+    }
+  }
+
+  /**
+   * Writes the text as a critical message in a block of its own
+   * */
+  void writeFromSignal(const char *data, size_t size) override {
+    char record[IndexedLogFormat::MESSAGE_HEADER_SIZE + 1024];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t nanoseconds = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+    size = std::min(size, sizeof(record) - IndexedLogFormat::MESSAGE_HEADER_SIZE);
+    encodeHeader(record, nanoseconds, 0, CRITICAL_LEVEL, size);
+    memcpy(record + IndexedLogFormat::MESSAGE_HEADER_SIZE, data, size);
+
+    IndexedLogFormat::BlockInfo entry;
+    entry.add(nanoseconds, CRITICAL_LEVEL, 0);
+    writeFromSignalBlock(entry, record,
+                         IndexedLogFormat::MESSAGE_HEADER_SIZE + size);
+  }
+
+private:
+  // Level::CRITICAL_ERROR, this header doesn't need the logger
+  static constexpr int CRITICAL_LEVEL = 4;
+
+  static void encodeHeader(char *header, int64_t unixNanoseconds, uint32_t id,
+                           int level, size_t size) {
+    IndexedLogFormat::write(header, unixNanoseconds);
+    IndexedLogFormat::write(header + 8, id);
+    IndexedLogFormat::write(
+        header + 12,
+        (uint32_t)size | (uint32_t)level << IndexedLogFormat::LEVEL_SHIFT);
+  }
+
+  /**
+   * Hashes each format string once, formats are usually string literals so
+   * their address identifies them
+   * */
+  uint32_t cachedFormatId(const char *format) {
+    FormatIdSlot &slot =
+        formatIds[((uintptr_t)format >> 3) % FORMAT_ID_CACHE_SIZE];
+
+    if (slot.format != format) {
+      slot.format = format;
+      slot.id = IndexedLogFormat::formatId(format);
+    }
+
+    return slot.id;
+  }
+
+  /**
+   * Offset the next write to the data file lands at, taken from the file
+   * so blocks written from a signal handler don't shift the live block
+   * */
+  uint64_t dataEnd() const {
+    off_t offset = ::lseek(dataDescriptor, 0, SEEK_CUR);
+    return offset < 0 ? 0 : (uint64_t)offset;
+  }
+
+  /**
+   * Writes a block and its entry without touching the live block
+   * Only calls lseek() and write(), so it is async-signal-safe
+   * */
+  void writeFromSignalBlock(IndexedLogFormat::BlockInfo &entry,
+                            const char *data, size_t size) {
+    entry.offset = dataEnd();
+    entry.size = (uint32_t)size;
+    BufferedFileSink::writeAll(dataDescriptor, data, size);
+    writeIndexEntry(entry);
+  }
+
+  void writeIndexEntry(const IndexedLogFormat::BlockInfo &info) {
+    char entry[IndexedLogFormat::ENTRY_SIZE];
+    info.encode(entry);
+    BufferedFileSink::writeAll(indexDescriptor, entry, sizeof(entry));
+  }
+
+  static constexpr size_t FORMAT_ID_CACHE_SIZE = 256;
+
+  struct FormatIdSlot {
+    const char *format = nullptr;
+    uint32_t id = 0;
+  };
+
+  int dataDescriptor;
+  int indexDescriptor;
+  size_t capacity;
+  std::unique_ptr<char[]> buffer;
+  std::atomic<size_t> used;
+
+  // the entry of the block being filled
+  IndexedLogFormat::BlockInfo block;
+  int64_t lastNanoseconds = 0;
+  FormatIdSlot formatIds[FORMAT_ID_CACHE_SIZE];
+};
+
+/**
+ * Reads the index and blocks of a file written by IndexedFileSink
+ * readBlock can be called from several threads at once
+ * */
+class IndexedLogReader {
+public:
+  ~IndexedLogReader() {
+    if (descriptor >= 0) {
+      ::close(descriptor);
+    }
+  }
+
+  bool open(const char *path) {
+    descriptor = ::open(path, O_RDONLY);
+    char header[IndexedLogFormat::DATA_HEADER_SIZE];
+
+    if (descriptor < 0 ||
+        ::pread(descriptor, header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header, IndexedLogFormat::DATA_MAGIC, 4) != 0) {
+      return false;
+    }
+
+    FILE *index = fopen((std::string(path) + ".idx").c_str(), "rb");
+
+    if (!index) {
+      return false;
+    }
+
+    char entry[IndexedLogFormat::ENTRY_SIZE];
+    bool valid =
+        fread(header, 1, IndexedLogFormat::INDEX_HEADER_SIZE, index) ==
+            IndexedLogFormat::INDEX_HEADER_SIZE &&
+        memcmp(header, IndexedLogFormat::INDEX_MAGIC, 4) == 0 &&
+        IndexedLogFormat::read<uint32_t>(header + 4) ==
+            IndexedLogFormat::ENTRY_SIZE;
+
+    while (valid && fread(entry, 1, sizeof(entry), index) == sizeof(entry)) {
+      blocks.emplace_back();
+      blocks.back().decode(entry);
+    }
+
+    fclose(index);
+
+    if (!valid) {
+      return false;
+    }
+
+    // data written after the last entry, when the writer didn't finish
+    struct stat info;
+    uint64_t indexed = blocks.empty() ? IndexedLogFormat::DATA_HEADER_SIZE
+                                      : blocks.back().offset + blocks.back().size;
+
+    if (fstat(descriptor, &info) == 0 && (uint64_t)info.st_size > indexed) {
+      IndexedLogFormat::BlockInfo tail;
+      tail.offset = indexed;
+      tail.size = (uint32_t)std::min<uint64_t>(info.st_size - indexed,
+                                               UINT32_MAX);
+      tail.firstNanoseconds = INT64_MIN;
+      tail.lastNanoseconds = INT64_MAX;
+      tail.levelMask = ~0u;
+      memset(tail.formats, 0xFF, sizeof(tail.formats));
+      blocks.push_back(tail);
+    }
+
+    return true;
+  }
+
+  const std::vector<IndexedLogFormat::BlockInfo> &getBlocks() const {
+    return blocks;
+  }
+
+  /**
+   * Reads the data of a block
+   * @return false if the file is shorter than the index says
+   * */
+  bool readBlock(const IndexedLogFormat::BlockInfo &block,
+                 std::vector<char> &data) const {
+    data.resize(block.size);
+    size_t done = 0;
+
+    while (done < block.size) {
+      ssize_t got = ::pread(descriptor, data.data() + done, block.size - done,
+                            (off_t)(block.offset + done));
+
+      if (got <= 0) {
+        data.resize(done);
+        return false;
+      }
+
+      done += (size_t)got;
+    }
+
+    return true;
+  }
+
+private:
+  int descriptor = -1;
+  std::vector<IndexedLogFormat::BlockInfo> blocks;
+};
+
+#endif
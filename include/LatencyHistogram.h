@@ -0,0 +1,158 @@
+#ifndef INCLUDE_LATENCY_HISTOGRAM_H
+#define INCLUDE_LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Summary of a histogram at one point in time, all values in nanoseconds
+ * */
+struct LatencySummary {
+  uint64_t count = 0;
+  uint64_t p50 = 0;
+  uint64_t p99 = 0;
+  uint64_t p999 = 0;
+  uint64_t max = 0;
+  double mean = 0;
+};
+
+/**
+ * Log-bucketed histogram of nanosecond durations in the style of HDR histogram
+ * Values below 16 get a bucket each, every power of two above that is split
+ * into 16 buckets, so a value is reported to within 1/16th of itself
+ * Recording is a relaxed atomic increment and never takes a lock, so a
+ * histogram can be read from another thread while it is being written
+ * Values above 2^40ns (about 18 minutes) are counted in the last bucket
+ * */
+class LatencyHistogram {
+public:
+  static constexpr int SUB_BUCKET_BITS = 4;
+  static constexpr int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+  static constexpr int MAX_VALUE_BITS = 40;
+  static constexpr int BUCKET_COUNT =
+      (MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) * SUB_BUCKET_COUNT;
+
+  LatencyHistogram() { reset(); }
+
+  LatencyHistogram(const LatencyHistogram &) = delete;
+  LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+  inline void record(uint64_t nanoseconds) {
+    buckets[bucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t currentMax = max.load(std::memory_order_relaxed);
+    while (nanoseconds > currentMax &&
+           !max.compare_exchange_weak(currentMax, nanoseconds,
+                                      std::memory_order_relaxed)) {
+    }
+  }
+
+  void reset() {
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+      buckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+  }
+
+  uint64_t getCount() const { return count.load(std::memory_order_relaxed); }
+
+  uint64_t getMax() const { return max.load(std::memory_order_relaxed); }
+
+  double getMean() const {
+    uint64_t n = getCount();
+    return n ? (double)sum.load(std::memory_order_relaxed) / (double)n : 0;
+  }
+
+  /**
+   * Returns the value below which the given fraction of the samples fall
+   * @param fraction between 0 and 1, .99 for the 99th percentile
+   * @return the highest value that shares a bucket with the percentile
+   * */
+  uint64_t percentile(double fraction) const {
+    uint64_t total = getCount();
+
+    if (total == 0) {
+      return 0;
+    }
+
+    uint64_t target = (uint64_t)(fraction * (double)total + .5);
+    target = target ? target : 1;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+      seen += buckets[i].load(std::memory_order_relaxed);
+
+      if (seen >= target) {
+        uint64_t value = bucketHighestValue(i);
+        uint64_t highest = getMax();
+        return value < highest ? value : highest;
+      }
+    }
+
+    return getMax();
+  }
+
+  LatencySummary summarize() const {
+    LatencySummary summary;
+    summary.count = getCount();
+    summary.p50 = percentile(.5);
+    summary.p99 = percentile(.99);
+    summary.p999 = percentile(.999);
+    summary.max = getMax();
+    summary.mean = getMean();
+    return summary;
+  }
+
+  static inline int bucketIndex(uint64_t value) {
+    if (value < SUB_BUCKET_COUNT) {
+      return (int)value;
+    }
+
+    int msb = highestBit(value);
+
+    if (msb > MAX_VALUE_BITS) {
+      return BUCKET_COUNT - 1;
+    }
+
+    int major = msb - SUB_BUCKET_BITS + 1;
+    int sub = (int)(value >> (msb - SUB_BUCKET_BITS)) - SUB_BUCKET_COUNT;
+    return major * SUB_BUCKET_COUNT + sub;
+  }
+
+  static inline uint64_t bucketHighestValue(int index) {
+    int major = index / SUB_BUCKET_COUNT;
+    uint64_t sub = index % SUB_BUCKET_COUNT;
+
+    if (major == 0) {
+      return sub;
+    }
+
+    uint64_t width = 1ull << (major - 1);
+    return ((SUB_BUCKET_COUNT + sub) << (major - 1)) + width - 1;
+  }
+
+private:
+  static inline int highestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1) {
+      bit++;
+    }
+    return bit;
+#endif
+  }
+
+  std::atomic<uint64_t> buckets[BUCKET_COUNT];
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> max;
+};
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef INCLUDE_LOG_ARGS_H
+#define INCLUDE_LOG_ARGS_H
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <string.h>
+#include <string_view>
+
+/**
+ * One argument of a message kept by value, so the message can be formatted
+ * after the call that logged it has returned
+ * Text and memory are held by pointer and size, pointing into storage owned
+ * by whoever stored the argument. A pointer stored without a length has
+ * size NO_SIZE
+ * */
+struct StoredArg {
+  static constexpr size_t NO_SIZE = SIZE_MAX;
+
+  union {
+    uint64_t integer;
+    double real;
+    const void *pointer;
+  };
+
+  size_t size;
+};
+
+/**
+ * Hands out the arguments of a message in order, either straight from the
+ * va_list of the call or from stored arguments, which the typed front-ends
+ * and the backtrace use
+ * Reading past the end of the stored arguments gives zeros and empty text
+ * */
+class LogArgs {
+public:
+  explicit LogArgs(va_list &list)
+      : list(&list), stored(nullptr), count(0), index(0), replayed(false) {}
+
+  /**
+   * @param replayed true for arguments kept by the backtrace, whose user
+   * formatted values were turned into text when they were kept
+   * */
+  LogArgs(const StoredArg *stored, size_t count, bool replayed)
+      : list(nullptr), stored(stored), count(count), index(0),
+        replayed(replayed) {}
+
+  LogArgs(const LogArgs &) = delete;
+  LogArgs &operator=(const LogArgs &) = delete;
+
+  /**
+   * Returns true when the arguments were kept by the backtrace
+   * */
+  inline bool isReplayed() const { return replayed; }
+
+  // char, short and int arguments are promoted to int when passed
+  inline int nextInt() {
+    return list ? va_arg(*list, int) : (int)nextStored().integer;
+  }
+
+  inline uint32_t nextUInt32() {
+    return list ? va_arg(*list, uint32_t) : (uint32_t)nextStored().integer;
+  }
+
+  inline uint64_t nextUInt64() {
+    return list ? va_arg(*list, uint64_t) : nextStored().integer;
+  }
+
+  // float arguments are promoted to double when passed
+  inline double nextDouble() {
+    return list ? va_arg(*list, double) : nextStored().real;
+  }
+
+  inline const void *nextPointer() {
+    return list ? va_arg(*list, const void *) : nextStored().pointer;
+  }
+
+  inline size_t nextSize() {
+    return list ? va_arg(*list, size_t) : (size_t)nextStored().integer;
+  }
+
+  /**
+   * Returns the length of a buffer or array parameter
+   * @param available set to the elements that can be read, fewer than the
+   * length when the backtrace kept only part of them
+   * */
+  inline size_t nextCount(size_t &available) {
+    if (list || !replayed) {
+      available = nextSize();
+      return available;
+    }
+
+    const StoredArg &arg = nextStored();
+    available = arg.size;
+    return (size_t)arg.integer;
+  }
+
+  /**
+   * Returns a string parameter, a null pointer gives empty text
+   * A stored string with a length, such as a std::string_view, keeps that
+   * length, a C string is read up to its terminator
+   * */
+  inline std::string_view nextString() {
+    const char *text;
+    size_t size = StoredArg::NO_SIZE;
+
+    if (list) {
+      text = va_arg(*list, const char *);
+    } else {
+      const StoredArg &arg = nextStored();
+      text = (const char *)arg.pointer;
+      size = arg.size;
+    }
+
+    if (!text) {
+      return std::string_view("", 0);
+    }
+
+    return std::string_view(text,
+                            size == StoredArg::NO_SIZE ? strlen(text) : size);
+  }
+
+  // passed as a pointer followed by a size_t length
+  inline std::string_view nextView() {
+    if (list) {
+      const char *text = va_arg(*list, const char *);
+      return std::string_view(text, va_arg(*list, size_t));
+    }
+
+    const StoredArg &arg = nextStored();
+    return std::string_view((const char *)arg.pointer, arg.size);
+  }
+
+private:
+  inline const StoredArg &nextStored() {
+    static const StoredArg empty = {{0}, 0};
+    return index < count ? stored[index++] : empty;
+  }
+
+  va_list *list;
+  const StoredArg *stored;
+  size_t count;
+  size_t index;
+  bool replayed;
+};
+
+#endif
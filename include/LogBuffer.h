@@ -0,0 +1,113 @@
+#ifndef INCLUDE_LOG_BUFFER_H
+#define INCLUDE_LOG_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string.h>
+
+/**
+ * Growable character buffer that each log line is formatted into
+ * The formatting functions write straight into the buffer and the finished
+ * line is handed to the output with a single write
+ * Storage is kept between messages, so once the buffer has grown to fit the
+ * longest line no more heap allocations are made
+ * */
+class LogBuffer {
+public:
+  LogBuffer() : buffer(nullptr), length(0), capacity(0), allocations(0) {}
+
+  ~LogBuffer() { free(buffer); }
+
+  LogBuffer(const LogBuffer &) = delete;
+  LogBuffer &operator=(const LogBuffer &) = delete;
+
+  inline char *data() { return buffer; }
+
+  inline const char *data() const { return buffer; }
+
+  inline size_t size() const { return length; }
+
+  inline void clear() { length = 0; }
+
+  /**
+   * Returns the number of times the buffer has gone to the heap for memory
+   * */
+  inline uint64_t getAllocationCount() const { return allocations; }
+
+  /**
+   * Makes room for count more characters at the end of the buffer
+   * @return a pointer to the first of the new characters
+   * */
+  inline char *extend(size_t count) {
+    if (length + count > capacity) {
+      grow(length + count);
+    }
+
+    char *start = buffer + length;
+    length += count;
+    return start;
+  }
+
+  /**
+   * Makes sure count more characters fit without growing again
+   * */
+  inline void reserve(size_t count) {
+    if (length + count > capacity) {
+      grow(length + count);
+    }
+  }
+
+  /**
+   * Drops everything after newLength, used after extending by an upper bound
+   * */
+  inline void truncate(size_t newLength) {
+    if (newLength < length) {
+      length = newLength;
+    }
+  }
+
+  inline void append(const char *text, size_t count) {
+    if (count) {
+      memcpy(extend(count), text, count);
+    }
+  }
+
+  inline void append(char c) { *extend(1) = c; }
+
+  /**
+   * Appends count copies of the character c
+   * */
+  inline void fill(char c, size_t count) {
+    if (count) {
+      memset(extend(count), c, count);
+    }
+  }
+
+private:
+  void grow(size_t needed) {
+    size_t newCapacity = capacity ? capacity * 2 : 256;
+
+    while (newCapacity < needed) {
+      newCapacity *= 2;
+    }
+
+    char *newBuffer = (char *)realloc(buffer, newCapacity);
+
+    if (!newBuffer) {
+      throw std::bad_alloc();
+    }
+
+    buffer = newBuffer;
+    capacity = newCapacity;
+    allocations++;
+  }
+
+  char *buffer;
+  size_t length;
+  size_t capacity;
+  uint64_t allocations;
+};
+
+#endif
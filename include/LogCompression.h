@@ -0,0 +1,413 @@
+#ifndef INCLUDE_LOG_COMPRESSION_H
+#define INCLUDE_LOG_COMPRESSION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/**
+ * LZ77 block codec for log text, plus the file layout that
+ * CompressedFileSink writes and CompressedLogReader reads
+ *
+ * A block is a run of sequences in the layout of LZ4:
+ *   token: high nibble literal count, low nibble match length - 4,
+ *          a nibble of 15 continues in following bytes of 255 until one is
+ *          below 255
+ *   literals
+ *   offset: 2 bytes little endian, distance back to the match
+ *   (the last sequence has literals only)
+ * Matches may reach back into a dictionary of up to 64KB that is shared by
+ * every block of a file, so repeated prefixes and format text compress well
+ * from the first line of each block. Blocks are independent otherwise
+ *
+ * File:
+ *   "DLZ1", uint32 dictionary size, dictionary
+ *   blocks: uint32 original size, uint32 stored size, data
+ *   a stored size with STORED_FLAG set means the data is not compressed
+ *   the original size is at most MAX_BLOCK_SIZE
+ * All integers are little endian
+ * */
+namespace LogCompression {
+
+static const char MAGIC[4] = {'D', 'L', 'Z', '1'};
+static constexpr uint32_t STORED_FLAG = 0x80000000u;
+static constexpr size_t BLOCK_HEADER_SIZE = 8;
+static constexpr size_t MAX_DICTIONARY = 65535;
+static constexpr size_t MAX_BLOCK_SIZE = 1 << 26;
+static constexpr size_t MAX_OFFSET = 65535;
+static constexpr size_t MIN_MATCH = 4;
+
+inline size_t compressBound(size_t size) { return size + size / 255 + 16; }
+
+inline void writeUInt32(char *out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out[i] = (char)(value >> (i * 8));
+  }
+}
+
+inline uint32_t readUInt32(const char *in) {
+  uint32_t value = 0;
+
+  for (int i = 0; i < 4; ++i) {
+    value |= (uint32_t)(unsigned char)in[i] << (i * 8);
+  }
+
+  return value;
+}
+
+/**
+ * Finds matches with hash chains and one step of lazy matching
+ * Keeps its tables between blocks so compressing doesn't allocate
+ * */
+class Compressor {
+public:
+  static constexpr int HASH_BITS = 16;
+  static constexpr int SEARCH_DEPTH = 32;
+
+  Compressor() : head((size_t)1 << HASH_BITS) {}
+
+  /**
+   * @param dst must have room for compressBound(size) bytes
+   * @return the compressed size
+   * */
+  size_t compress(const char *dictionary, size_t dictionarySize,
+                  const char *src, size_t size, char *dst) {
+    dictionarySize = dictionarySize > MAX_DICTIONARY ? MAX_DICTIONARY
+                                                     : dictionarySize;
+    window.resize(dictionarySize + size);
+    memcpy(window.data(), dictionary, dictionarySize);
+    memcpy(window.data() + dictionarySize, src, size);
+    chain.resize(window.size());
+    std::fill(head.begin(), head.end(), -1);
+
+    const char *w = window.data();
+    size_t end = window.size();
+
+    for (size_t p = 0; p + MIN_MATCH <= dictionarySize; ++p) {
+      insert(w, p);
+    }
+
+    char *out = dst;
+    size_t anchor = dictionarySize;
+    size_t p = dictionarySize;
+
+    while (p + MIN_MATCH <= end) {
+      size_t offset = 0;
+      size_t length = findMatch(w, p, end, offset);
+
+      if (length < MIN_MATCH) {
+        insert(w, p);
+        p++;
+        continue;
+      }
+
+      // a longer match starting one byte later is worth a literal
+      insert(w, p);
+      size_t nextOffset = 0;
+      size_t nextLength =
+          p + 1 + MIN_MATCH <= end ? findMatch(w, p + 1, end, nextOffset) : 0;
+
+      if (nextLength > length + 1) {
+        p++;
+        length = nextLength;
+        offset = nextOffset;
+        insert(w, p);
+      }
+
+      out = writeSequence(out, w + anchor, p - anchor, offset, length);
+
+      for (size_t i = p + 1; i < p + length && i + MIN_MATCH <= end; ++i) {
+        insert(w, i);
+      }
+
+      p += length;
+      anchor = p;
+    }
+
+    out = writeSequence(out, w + anchor, end - anchor, 0, 0);
+    return (size_t)(out - dst);
+  }
+
+private:
+  static inline uint32_t read32(const char *p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+  }
+
+  static inline uint32_t hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+  }
+
+  inline void insert(const char *w, size_t p) {
+    uint32_t h = hash(read32(w + p));
+    chain[p] = head[h];
+    head[h] = (int32_t)p;
+  }
+
+  size_t findMatch(const char *w, size_t p, size_t end, size_t &offset) {
+    uint32_t first = read32(w + p);
+    int32_t candidate = head[hash(first)];
+    size_t best = 0;
+
+    for (int depth = 0; depth < SEARCH_DEPTH && candidate >= 0; ++depth) {
+      size_t c = (size_t)candidate;
+
+      if (p - c > MAX_OFFSET) {
+        break;
+      }
+
+      if (read32(w + c) == first && w[c + best] == w[p + best]) {
+        size_t length = MIN_MATCH;
+
+        while (p + length < end && w[c + length] == w[p + length]) {
+          length++;
+        }
+
+        if (length > best) {
+          best = length;
+          offset = p - c;
+
+          if (p + length == end) {
+            break;
+          }
+        }
+      }
+
+      candidate = chain[c];
+    }
+
+    return best;
+  }
+
+  static char *writeLength(char *out, size_t length) {
+    while (length >= 255) {
+      *out++ = (char)255;
+      length -= 255;
+    }
+
+    *out++ = (char)length;
+    return out;
+  }
+
+  static char *writeSequence(char *out, const char *literals,
+                             size_t literalCount, size_t offset,
+                             size_t matchLength) {
+    size_t matchCode = matchLength ? matchLength - MIN_MATCH : 0;
+    *out++ = (char)(((literalCount < 15 ? literalCount : 15) << 4) |
+                    (matchCode < 15 ? matchCode : 15));
+
+    if (literalCount >= 15) {
+      out = writeLength(out, literalCount - 15);
+    }
+
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+
+    if (matchLength) {
+      *out++ = (char)(offset & 0xFF);
+      *out++ = (char)(offset >> 8);
+
+      if (matchCode >= 15) {
+        out = writeLength(out, matchCode - 15);
+      }
+    }
+
+    return out;
+  }
+
+  std::vector<char> window;
+  std::vector<int32_t> head;
+  std::vector<int32_t> chain;
+};
+
+/**
+ * @return the decompressed size, or -1 if the data is corrupt or doesn't
+ * fit in capacity
+ * */
+inline int64_t decompress(const char *dictionary, size_t dictionarySize,
+                          const char *src, size_t size, char *dst,
+                          size_t capacity) {
+  const unsigned char *in = (const unsigned char *)src;
+  const unsigned char *inEnd = in + size;
+  size_t op = 0;
+
+  while (in < inEnd) {
+    unsigned token = *in++;
+    size_t literalCount = token >> 4;
+
+    if (literalCount == 15) {
+      unsigned char b;
+
+      do {
+        if (in >= inEnd) {
+          return -1;
+        }
+
+        b = *in++;
+        literalCount += b;
+      } while (b == 255);
+    }
+
+    if (literalCount > (size_t)(inEnd - in) || literalCount > capacity - op) {
+      return -1;
+    }
+
+    memcpy(dst + op, in, literalCount);
+    in += literalCount;
+    op += literalCount;
+
+    // the last sequence ends after its literals
+    if (in >= inEnd) {
+      break;
+    }
+
+    if (inEnd - in < 2) {
+      return -1;
+    }
+
+    size_t offset = in[0] | ((size_t)in[1] << 8);
+    in += 2;
+    size_t length = (token & 15);
+
+    if (length == 15) {
+      unsigned char b;
+
+      do {
+        if (in >= inEnd) {
+          return -1;
+        }
+
+        b = *in++;
+        length += b;
+      } while (b == 255);
+    }
+
+    length += MIN_MATCH;
+
+    if (offset == 0 || offset > op + dictionarySize || length > capacity - op) {
+      return -1;
+    }
+
+    if (offset <= op && offset >= length) {
+      memcpy(dst + op, dst + op - offset, length);
+      op += length;
+      continue;
+    }
+
+    for (size_t i = 0; i < length; ++i, ++op) {
+      dst[op] = offset <= op ? dst[op - offset]
+                             : dictionary[dictionarySize - (offset - op)];
+    }
+  }
+
+  return (int64_t)op;
+}
+
+/**
+ * Reads the blocks of a file written by CompressedFileSink
+ * */
+class CompressedLogReader {
+public:
+  ~CompressedLogReader() {
+    if (file) {
+      fclose(file);
+    }
+  }
+
+  bool open(const char *path) {
+    file = fopen(path, "rb");
+
+    if (!file || fseek(file, 0, SEEK_END) != 0) {
+      return false;
+    }
+
+    fileSize = (uint64_t)ftell(file);
+    rewind(file);
+
+    char header[8];
+
+    if (fread(header, 1, 8, file) != 8 || memcmp(header, MAGIC, 4) != 0) {
+      return false;
+    }
+
+    uint32_t dictionarySize = readUInt32(header + 4);
+
+    if (dictionarySize > MAX_DICTIONARY || dictionarySize > remaining()) {
+      return false;
+    }
+
+    dictionary.resize(dictionarySize);
+    return dictionary.empty() ||
+           fread(dictionary.data(), 1, dictionary.size(), file) ==
+               dictionary.size();
+  }
+
+  /**
+   * Reads the next block into text
+   * @return false at the end of the file or on a corrupt block, check
+   * isCorrupt() to tell them apart
+   * */
+  bool next(std::string &text) {
+    char header[BLOCK_HEADER_SIZE];
+    size_t got = file ? fread(header, 1, BLOCK_HEADER_SIZE, file) : 0;
+
+    if (got != BLOCK_HEADER_SIZE) {
+      corrupt = got != 0;
+      return false;
+    }
+
+    uint32_t originalSize = readUInt32(header);
+    uint32_t storedSize = readUInt32(header + 4);
+    bool stored = (storedSize & STORED_FLAG) != 0;
+    storedSize &= ~STORED_FLAG;
+
+    // the sizes come from the file, check them before allocating
+    if (originalSize > MAX_BLOCK_SIZE || storedSize > remaining() ||
+        (stored && storedSize != originalSize)) {
+      corrupt = true;
+      return false;
+    }
+
+    data.resize(storedSize);
+
+    if (fread(data.data(), 1, storedSize, file) != storedSize) {
+      corrupt = true;
+      return false;
+    }
+
+    if (stored) {
+      text.assign(data.data(), storedSize);
+      return true;
+    }
+
+    text.resize(originalSize);
+    int64_t size = decompress(dictionary.data(), dictionary.size(),
+                              data.data(), storedSize, &text[0], originalSize);
+
+    if (size != (int64_t)originalSize) {
+      corrupt = true;
+      return false;
+    }
+
+    return true;
+  }
+
+  bool isCorrupt() const { return corrupt; }
+
+private:
+  uint64_t remaining() { return fileSize - (uint64_t)ftell(file); }
+
+  FILE *file = nullptr;
+  uint64_t fileSize = 0;
+  bool corrupt = false;
+  std::vector<char> dictionary;
+  std::vector<char> data;
+};
+
+} // namespace LogCompression
+
+#endif
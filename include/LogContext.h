@@ -0,0 +1,162 @@
+#ifndef INCLUDE_LOG_CONTEXT_H
+#define INCLUDE_LOG_CONTEXT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string.h>
+#include <string_view>
+#include <type_traits>
+
+#include "NumberFormat.h"
+
+/**
+ * Key and value attached to every message the current thread logs while
+ * the LogContext is alive, such as the request being served
+ * [ctx] in a prefix prints the fields of the thread as key=value pairs
+ * separated by spaces, oldest first
+ * {
+ *   LogContext request("request", requestId);
+ *   logger.trace("loading");  // TCE request=8f3a: loading
+ * }
+ *
+ * The fields are formatted once, when the LogContext is made, into a fixed
+ * buffer per thread, so messages only point at the text. Fields that don't
+ * fit in MAX_FIELDS or TEXT_CAPACITY are left out, values are cut to fit
+ * LogContexts must be destroyed in the reverse order they were made, on the
+ * thread that made them, which local variables do on their own
+ * */
+class LogContext {
+public:
+  static constexpr int MAX_FIELDS = 16;
+  static constexpr size_t TEXT_CAPACITY = 512;
+
+  struct Field {
+    std::string_view key;
+    std::string_view value;
+  };
+
+  LogContext(std::string_view key, std::string_view value) {
+    pushed = push(key, value);
+  }
+
+  LogContext(std::string_view key, const char *value)
+      : LogContext(key, std::string_view(value)) {}
+
+  template <typename T,
+            typename = std::enable_if_t<std::is_integral_v<T> &&
+                                        !std::is_same_v<T, bool>>>
+  LogContext(std::string_view key, T value) {
+    char digits[24];
+    int length = std::is_signed_v<T>
+                     ? NumberFormat::writeSigned(digits, (int64_t)value)
+                     : NumberFormat::writeUnsigned(digits, (uint64_t)value);
+    pushed = push(key, std::string_view(digits, (size_t)length));
+  }
+
+  ~LogContext() {
+    if (pushed) {
+      Stack &fields = stack();
+      fields.count--;
+      fields.length = fields.entries[fields.count].lengthBefore;
+    }
+  }
+
+  LogContext(const LogContext &) = delete;
+  LogContext &operator=(const LogContext &) = delete;
+
+  /**
+   * Returns the fields of the calling thread as they are printed by [ctx]
+   * */
+  static std::string_view text() {
+    Stack &fields = stack();
+    return std::string_view(fields.text, fields.length);
+  }
+
+  /**
+   * Returns the number of fields of the calling thread
+   * */
+  static int size() { return stack().count; }
+
+  /**
+   * Returns a field of the calling thread, 0 is the oldest
+   * */
+  static Field field(int index) {
+    Stack &fields = stack();
+    const Entry &entry = fields.entries[index];
+    return {std::string_view(fields.text + entry.keyStart, entry.keyLength),
+            std::string_view(fields.text + entry.valueStart,
+                             entry.valueLength)};
+  }
+
+private:
+  struct Entry {
+    uint16_t keyStart;
+    uint16_t keyLength;
+    uint16_t valueStart;
+    uint16_t valueLength;
+
+    // text length before this field was added
+    uint16_t lengthBefore;
+  };
+
+  /**
+   * The fields of one thread, trivial so the thread_local needs no
+   * initialization
+   * */
+  struct Stack {
+    char text[TEXT_CAPACITY];
+    size_t length;
+    Entry entries[MAX_FIELDS];
+    int count;
+  };
+
+  static_assert(TEXT_CAPACITY <= UINT16_MAX, "offsets are 16 bits");
+
+  static Stack &stack() {
+    thread_local Stack fields;
+    return fields;
+  }
+
+  /**
+   * Appends " key=value" to the thread's text
+   * @return false if the field doesn't fit
+   * */
+  static bool push(std::string_view key, std::string_view value) {
+    Stack &fields = stack();
+    size_t separator = fields.length ? 1 : 0;
+
+    if (fields.count == MAX_FIELDS ||
+        fields.length + separator + key.size() + 1 > TEXT_CAPACITY) {
+      return false;
+    }
+
+    Entry &entry = fields.entries[fields.count++];
+    entry.lengthBefore = (uint16_t)fields.length;
+
+    char *out = fields.text + fields.length;
+
+    if (separator) {
+      *out++ = ' ';
+    }
+
+    memcpy(out, key.data(), key.size());
+    entry.keyStart = (uint16_t)(out - fields.text);
+    entry.keyLength = (uint16_t)key.size();
+    out += key.size();
+    *out++ = '=';
+
+    size_t room = TEXT_CAPACITY - (size_t)(out - fields.text);
+    size_t valueLength = value.size() < room ? value.size() : room;
+    memcpy(out, value.data(), valueLength);
+    entry.valueStart = (uint16_t)(out - fields.text);
+    entry.valueLength = (uint16_t)valueLength;
+    out += valueLength;
+
+    fields.length = (size_t)(out - fields.text);
+    return true;
+  }
+
+  bool pushed;
+};
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef INCLUDE_LOG_RING_H
+#define INCLUDE_LOG_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string.h>
+#include <vector>
+
+#include "LogSink.h"
+
+/**
+ * Single producer, single consumer ring of log lines, used to hand lines
+ * from the thread or process that logs them to the one that writes them
+ *
+ * The producer moves head and the consumer moves tail. Positions only grow,
+ * the byte they point at is position & (capacity - 1), so the capacity must
+ * be a power of two. The atomics are lock free, so a ring can live in
+ * memory shared between processes
+ *
+ * record, 8 byte aligned:
+ *   line size (4 bytes), level (4), unix time in nanoseconds (8),
+ *   format pointer (8, only meaningful in the producer's process), line text
+ * Records don't wrap, a size of WRAP_MARKER skips to the start of the ring
+ * */
+namespace LogRing {
+constexpr size_t HEADER_SIZE = 24;
+constexpr uint32_t WRAP_MARKER = UINT32_MAX;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "log rings need lock free 64 bit atomics");
+
+inline size_t recordSize(size_t lineSize) {
+  return (HEADER_SIZE + lineSize + 7) & ~(size_t)7;
+}
+
+/**
+ * A ring as its two positions and its storage
+ * */
+struct View {
+  std::atomic<uint64_t> *head;
+  std::atomic<uint64_t> *tail;
+  char *data;
+  size_t capacity;
+};
+
+struct Record {
+  int64_t unixNanoseconds;
+  int level;
+  const char *format;
+  const char *text;
+  size_t size;
+
+  // position of the record after this one
+  uint64_t next;
+};
+
+/**
+ * Copies a line into the ring, called by the producer only
+ * @return false if there isn't room for it until the consumer catches up
+ * */
+inline bool write(const View &ring, const char *data, size_t size,
+                  const LogMessageInfo &info) {
+  size_t needed = recordSize(size);
+  uint64_t head = ring.head->load(std::memory_order_relaxed);
+  size_t offset = (size_t)(head & (ring.capacity - 1));
+  size_t toEnd = ring.capacity - offset;
+  size_t total = needed > toEnd ? toEnd + needed : needed;
+
+  if (ring.capacity - (head - ring.tail->load(std::memory_order_acquire)) <
+      total) {
+    return false;
+  }
+
+  if (needed > toEnd) {
+    uint32_t skip = WRAP_MARKER;
+    memcpy(ring.data + offset, &skip, sizeof(skip));
+    head += toEnd;
+    offset = 0;
+  }
+
+  char *record = ring.data + offset;
+  uint32_t size32 = (uint32_t)size;
+  int32_t level = info.level;
+  uint64_t format = (uint64_t)(uintptr_t)info.format;
+  memcpy(record, &size32, 4);
+  memcpy(record + 4, &level, 4);
+  memcpy(record + 8, &info.unixNanoseconds, 8);
+  memcpy(record + 16, &format, 8);
+  memcpy(record + HEADER_SIZE, data, size);
+
+  ring.head->store(head + needed, std::memory_order_release);
+  return true;
+}
+
+/**
+ * Reads the record at position, which the consumer hasn't freed yet
+ * A record that doesn't fit between position and head is treated as not
+ * written yet, so a producer that died mid write can't send the reader
+ * outside the ring
+ * @return false if there is no complete record at position
+ * */
+inline bool read(const View &ring, uint64_t position, Record &record) {
+  uint64_t head = ring.head->load(std::memory_order_acquire);
+
+  if (position >= head) {
+    return false;
+  }
+
+  size_t offset = (size_t)(position & (ring.capacity - 1));
+  uint32_t size;
+  memcpy(&size, ring.data + offset, 4);
+
+  if (size == WRAP_MARKER) {
+    position += ring.capacity - offset;
+    offset = 0;
+
+    if (position >= head) {
+      return false;
+    }
+
+    memcpy(&size, ring.data, 4);
+  }
+
+  if (size > ring.capacity || recordSize(size) > ring.capacity - offset ||
+      recordSize(size) > head - position) {
+    return false;
+  }
+
+  const char *data = ring.data + offset;
+  int32_t level;
+  uint64_t format;
+  memcpy(&level, data + 4, 4);
+  memcpy(&record.unixNanoseconds, data + 8, 8);
+  memcpy(&format, data + 16, 8);
+  record.level = level;
+  record.format = (const char *)(uintptr_t)format;
+  record.text = data + HEADER_SIZE;
+  record.size = size;
+  record.next = position + recordSize(size);
+  return true;
+}
+
+/**
+ * Returns the time of the newest line of the ring that is furthest behind
+ * Producers only log forward in time, so every line up to it can be
+ * written in order without waiting for the others
+ * @param idleBound used for empty rings, their producer may still be about
+ * to copy a line it timestamped before the lines of the others, so pass the
+ * oldest time such a line can have, such as now minus the merge interval
+ * */
+inline int64_t watermark(const View *rings, int count, int64_t idleBound) {
+  int64_t oldest = INT64_MAX;
+
+  for (int i = 0; i < count; ++i) {
+    uint64_t position = rings[i].tail->load(std::memory_order_relaxed);
+    Record record;
+    bool any = false;
+
+    while (read(rings[i], position, record)) {
+      position = record.next;
+      any = true;
+    }
+
+    oldest = std::min(oldest, any ? record.unixNanoseconds : idleBound);
+  }
+
+  return oldest;
+}
+
+/**
+ * Writes the lines of several rings to one sink in timestamp order
+ * Keeps its buffers between merges so merging doesn't allocate
+ * */
+class Merger {
+public:
+  /**
+   * Writes the lines logged at or before cutoff and frees their space
+   * @param keepFormats false when the rings come from other processes, their
+   * format pointers aren't passed on
+   * @return the number of lines written
+   * */
+  size_t merge(const View *rings, int count, int64_t cutoff, LogSink &target,
+               bool keepFormats = true) {
+    pending.clear();
+    ends.resize((size_t)count);
+
+    for (int i = 0; i < count; ++i) {
+      uint64_t position = rings[i].tail->load(std::memory_order_relaxed);
+      Record record;
+
+      // a producer's lines are in order, so its part is a prefix
+      while (read(rings[i], position, record) &&
+             record.unixNanoseconds <= cutoff) {
+        pending.push_back(record);
+        position = record.next;
+      }
+
+      ends[i] = position;
+    }
+
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const Record &a, const Record &b) {
+                       return a.unixNanoseconds < b.unixNanoseconds;
+                     });
+
+    for (const Record &record : pending) {
+      LogMessageInfo info = {record.unixNanoseconds, record.level,
+                             keepFormats ? record.format : nullptr};
+      target.writeMessage(record.text, record.size, info);
+    }
+
+    for (int i = 0; i < count; ++i) {
+      rings[i].tail->store(ends[i], std::memory_order_release);
+    }
+
+    return pending.size();
+  }
+
+private:
+  std::vector<Record> pending;
+  std::vector<uint64_t> ends;
+};
+} // namespace LogRing
+
+#endif
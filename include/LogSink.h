@@ -0,0 +1,105 @@
+#ifndef INCLUDE_LOG_SINK_H
+#define INCLUDE_LOG_SINK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+
+/**
+ * What the logger knows about a line it hands to a sink
+ * */
+struct LogMessageInfo {
+  // wall clock time of the message in nanoseconds since 1970
+  int64_t unixNanoseconds;
+
+  // the Level of the message
+  int level;
+
+  // the format string the message was logged with, nullptr for lines
+  // replayed from the backtrace and text written through a stream
+  const char *format;
+};
+
+/**
+ * Destination for finished log lines that does its own buffering or queuing
+ * The logger hands over each line with a single write
+ * */
+class LogSink {
+public:
+  virtual ~LogSink() {}
+
+  virtual void write(const char *data, size_t size) = 0;
+
+  /**
+   * Writes one line the logger formatted, for sinks that keep more than
+   * the text. Lines written to the sink through a stream use write()
+   * */
+  virtual void writeMessage(const char *data, size_t size,
+                            const LogMessageInfo &) {
+    write(data, size);
+  }
+
+  /**
+   * Pushes out anything held back
+   * */
+  virtual void flush() {}
+
+  /**
+   * Pushes out anything held back, called from a fatal signal handler
+   * Must only use async-signal-safe calls, such as write(), and must not
+   * allocate or take locks
+   * */
+  virtual void flushFromSignal() {}
+
+  /**
+   * Writes text straight to the destination, called from a fatal signal
+   * handler after flushFromSignal with the same restrictions
+   * */
+  virtual void writeFromSignal(const char *, size_t) {}
+};
+
+/**
+ * Output stream that forwards everything written to it to a sink, so a sink
+ * can be used wherever the logger takes a stream
+ * */
+class LogSinkStream : public std::ostream {
+public:
+  explicit LogSinkStream(LogSink &sink) : std::ostream(nullptr), buffer(sink) {
+    rdbuf(&buffer);
+  }
+
+  LogSink &getSink() { return buffer.sink; }
+
+private:
+  class SinkBuffer : public std::streambuf {
+  public:
+    explicit SinkBuffer(LogSink &sink) : sink(sink) {}
+
+    LogSink &sink;
+
+  protected:
+    int_type overflow(int_type c) override {
+      if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        char ch = traits_type::to_char_type(c);
+        sink.write(&ch, 1);
+      }
+
+      return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *data, std::streamsize size) override {
+      sink.write(data, (size_t)size);
+      return size;
+    }
+
+    int sync() override {
+      sink.flush();
+      return 0;
+    }
+  };
+
+  SinkBuffer buffer;
+};
+
+#endif
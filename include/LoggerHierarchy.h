@@ -0,0 +1,214 @@
+#ifndef INCLUDE_LOGGER_HIERARCHY_H
+#define INCLUDE_LOGGER_HIERARCHY_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "DebugLogger.h"
+
+class LoggerHierarchy;
+
+/**
+ * Handle to a named logger such as "net.http", three pointers that can be
+ * copied freely
+ * Messages are checked against the name's level and then formatted and
+ * written by the DebugLogger the handle was made with, whatever that
+ * logger's own level is. So named loggers share its sink, prefix and
+ * variables, and [lgn] in the prefix prints the name. Messages below the
+ * name's level count as filtered by that logger and go to its backtrace
+ * */
+class NamedLogger {
+public:
+  /**
+   * A level set on a name and the level its messages are checked against,
+   * which is inherited from the closest parent with a level set
+   * */
+  struct Node {
+    std::string name;
+    Node *parent = nullptr;
+    std::vector<Node *> children;
+
+    // -1 when the level is inherited
+    int level = -1;
+    std::atomic<int> effectiveLevel{(int)Level::LEVEL_TRACE};
+  };
+
+  NamedLogger(DebugLogger &logger, LoggerHierarchy &hierarchy, Node &node)
+      : logger(&logger), hierarchy(&hierarchy), node(&node) {}
+
+  const std::string &getName() const { return node->name; }
+
+  Level getLevel() const {
+    return (Level)node->effectiveLevel.load(std::memory_order_relaxed);
+  }
+
+  bool isEnabled(Level lev) const {
+    return node->effectiveLevel.load(std::memory_order_relaxed) <= (int)lev;
+  }
+
+  /**
+   * Returns the handle of a name below this one, child("http") of "net" is
+   * "net.http"
+   * */
+  NamedLogger child(std::string_view name) const;
+
+  template <typename... Args>
+  int trace(const char *format, const Args &...args) {
+    return logToLevel(Level::LEVEL_TRACE, format, args...);
+  }
+
+  template <typename... Args>
+  int warning(const char *format, const Args &...args) {
+    return logToLevel(Level::LEVEL_WARNING, format, args...);
+  }
+
+  template <typename... Args>
+  int error(const char *format, const Args &...args) {
+    return logToLevel(Level::LEVEL_ERROR, format, args...);
+  }
+
+  template <typename... Args>
+  int critical(const char *format, const Args &...args) {
+    return logToLevel(Level::CRITICAL_ERROR, format, args...);
+  }
+
+  template <typename... Args>
+  int logToLevel(Level lev, const char *format, const Args &...args) {
+    if (!isEnabled(lev)) {
+      logger->logFiltered(lev, format, args...);
+      return 0;
+    }
+
+    return logger->logNamed(lev, node->name, format, args...);
+  }
+
+private:
+  DebugLogger *logger;
+  LoggerHierarchy *hierarchy;
+  Node *node;
+};
+
+/**
+ * Tree of logger names separated by dots, each with a level of its own or
+ * the level of its parent
+ * Setting a level updates the cached level of that name and of the names
+ * below it that inherit it, nothing else. Levels can be set from any thread
+ * while handles log
+ * Names are never removed, handles stay valid for the life of the hierarchy
+ * */
+class LoggerHierarchy {
+public:
+  /**
+   * @param rootLevel the level of the names with no level set above them
+   * */
+  explicit LoggerHierarchy(Level rootLevel = Level::LEVEL_TRACE) {
+    root.level = (int)rootLevel;
+    root.effectiveLevel.store((int)rootLevel);
+  }
+
+  LoggerHierarchy(const LoggerHierarchy &) = delete;
+  LoggerHierarchy &operator=(const LoggerHierarchy &) = delete;
+
+  /**
+   * Returns the handle of a name, logging through logger
+   * Give each thread its own logger, the handles of a name can share one
+   * hierarchy across threads
+   * @param name dot separated, empty for the root
+   * */
+  NamedLogger get(DebugLogger &logger, std::string_view name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return NamedLogger(logger, *this, findOrAdd(name));
+  }
+
+  /**
+   * Sets the level of a name and of the names below it that don't have
+   * their own
+   * */
+  void setLevel(std::string_view name, Level level) {
+    std::lock_guard<std::mutex> lock(mutex);
+    NamedLogger::Node &node = findOrAdd(name);
+    node.level = (int)level;
+    propagate(node);
+  }
+
+  /**
+   * Makes a name inherit its parent's level again, the root keeps its level
+   * */
+  void clearLevel(std::string_view name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    NamedLogger::Node &node = findOrAdd(name);
+
+    if (node.parent) {
+      node.level = -1;
+      propagate(node);
+    }
+  }
+
+  /**
+   * Returns the level the messages of a name are checked against
+   * */
+  Level getLevel(std::string_view name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return (Level)findOrAdd(name).effectiveLevel.load();
+  }
+
+private:
+  NamedLogger::Node &findOrAdd(std::string_view name) {
+    if (name.empty()) {
+      return root;
+    }
+
+    std::map<std::string, std::unique_ptr<NamedLogger::Node>,
+             std::less<>>::iterator found = nodes.find(name);
+
+    if (found != nodes.end()) {
+      return *found->second;
+    }
+
+    size_t dot = name.rfind('.');
+    NamedLogger::Node &parent =
+        findOrAdd(dot == std::string_view::npos ? std::string_view()
+                                                : name.substr(0, dot));
+
+    std::string key(name);
+    std::unique_ptr<NamedLogger::Node> node(new NamedLogger::Node());
+    node->name = key;
+    node->parent = &parent;
+    node->effectiveLevel.store(parent.effectiveLevel.load());
+    parent.children.push_back(node.get());
+    return *nodes.emplace(key, std::move(node)).first->second;
+  }
+
+  /**
+   * Recomputes the cached level of node and of the names below it that
+   * inherit from it
+   * */
+  void propagate(NamedLogger::Node &node) {
+    int level = node.level >= 0 ? node.level
+                                : node.parent->effectiveLevel.load();
+    node.effectiveLevel.store(level, std::memory_order_relaxed);
+
+    for (NamedLogger::Node *child : node.children) {
+      if (child->level < 0) {
+        propagate(*child);
+      }
+    }
+  }
+
+  std::mutex mutex;
+  NamedLogger::Node root;
+  std::map<std::string, std::unique_ptr<NamedLogger::Node>, std::less<>> nodes;
+};
+
+inline NamedLogger NamedLogger::child(std::string_view name) const {
+  std::string full = node->name.empty() ? std::string(name)
+                                        : node->name + "." + std::string(name);
+  return hierarchy->get(*logger, full);
+}
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef INCLUDE_NUMBER_FORMAT_H
+#define INCLUDE_NUMBER_FORMAT_H
+
+#include <cmath>
+#include <cstdint>
+#include <string.h>
+
+/**
+ * Number to text conversions used in place of sprintf
+ * Decimal digits are written two at a time from a table, back to front, into
+ * a buffer the caller provides, so nothing is parsed or allocated
+ * */
+namespace NumberFormat {
+
+static const char DIGIT_PAIRS[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+static const uint64_t POWERS_OF_TEN[] = {1ull,
+                                         10ull,
+                                         100ull,
+                                         1000ull,
+                                         10000ull,
+                                         100000ull,
+                                         1000000ull,
+                                         10000000ull,
+                                         100000000ull,
+                                         1000000000ull,
+                                         10000000000ull,
+                                         100000000000ull,
+                                         1000000000000ull,
+                                         10000000000000ull,
+                                         100000000000000ull,
+                                         1000000000000000ull,
+                                         10000000000000000ull,
+                                         100000000000000000ull,
+                                         1000000000000000000ull,
+                                         10000000000000000000ull};
+
+inline int digitCount(uint64_t value) {
+  int count = 1;
+
+  while (count < 20 && value >= POWERS_OF_TEN[count]) {
+    count++;
+  }
+
+  return count;
+}
+
+/**
+ * Writes exactly count digits of value, padding with leading zeros
+ * */
+inline void writeDigits(char *out, uint64_t value, int count) {
+  char *cursor = out + count;
+
+  while (count >= 2) {
+    cursor -= 2;
+    memcpy(cursor, DIGIT_PAIRS + (value % 100) * 2, 2);
+    value /= 100;
+    count -= 2;
+  }
+
+  if (count) {
+    *--cursor = (char)('0' + value % 10);
+  }
+}
+
+/**
+ * @param out must have room for 20 characters
+ * @return the number of characters written
+ * */
+inline int writeUnsigned(char *out, uint64_t value) {
+  int count = digitCount(value);
+  writeDigits(out, value, count);
+  return count;
+}
+
+/**
+ * @param out must have room for 20 characters
+ * @return the number of characters written
+ * */
+inline int writeSigned(char *out, int64_t value) {
+  if (value < 0) {
+    *out = '-';
+    return 1 + writeUnsigned(out + 1, 0 - (uint64_t)value);
+  }
+
+  return writeUnsigned(out, (uint64_t)value);
+}
+
+/**
+ * Writes value with the given number of decimals, producing the same text as
+ * the logger's float formatting: the value is rounded to at most 5 decimals,
+ * printed to 6, then cut or padded with zeros to decimals
+ * Only values whose digits are exact in a 64 bit integer are handled
+ * @param out must have room for 32 + decimals characters
+ * @return the number of characters written, or -1 if the value is too large,
+ * or not finite, and has to be printed the slow way
+ * */
+inline int writeFixed(char *out, double value, int decimals) {
+  decimals = (decimals == -1) ? 6 : decimals;
+  int rounded = decimals < 0 ? 0 : (decimals > 5 ? 5 : decimals);
+  uint64_t scale = POWERS_OF_TEN[rounded];
+
+  if (!(value > -1e9 && value < 1e9)) {
+    return -1;
+  }
+
+  double scaled = std::trunc(value * (double)scale + .5);
+
+  // a zero that came from a negative value still prints its sign
+  bool negative = std::signbit(scaled);
+  uint64_t magnitude = (uint64_t)(negative ? -scaled : scaled);
+  uint64_t whole = magnitude / scale;
+  uint64_t fraction = magnitude % scale;
+
+  char *cursor = out;
+
+  if (negative) {
+    *cursor++ = '-';
+  }
+
+  cursor += writeUnsigned(cursor, whole);
+
+  if (decimals > 0) {
+    int fractionDigits = decimals < rounded ? decimals : rounded;
+    *cursor++ = '.';
+    writeDigits(cursor, fraction / POWERS_OF_TEN[rounded - fractionDigits],
+                fractionDigits);
+    cursor += fractionDigits;
+    memset(cursor, '0', decimals - fractionDigits);
+    cursor += decimals - fractionDigits;
+  }
+
+  return (int)(cursor - out);
+}
+
+} // namespace NumberFormat
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef INCLUDE_PROFILER_H
+#define INCLUDE_PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "DebugLogger.h"
+#include "Timer.h"
+
+/**
+ * Aggregated timings for one label, all times in nanoseconds
+ * */
+struct ProfileEntry {
+  const char *label;
+  uint64_t count;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+  double mean;
+};
+
+/**
+ * Collects timings from ScopedTimers per label without logging each sample
+ * Labels are kept in a fixed size table, and adding a sample is a few relaxed
+ * atomic operations, so probes can stay in hot code and on several threads
+ * Labels must outlive the profiler, string literals are the intended use
+ * The summary is written through the logger, sorted by total time, either on
+ * demand with report(), every interval with setReportInterval() or when the
+ * profiler is destroyed with setReportOnShutdown()
+ * A DebugLogger may only be used by one thread, so the interval report is
+ * only written by the thread that made the profiler (see setLoggerThread).
+ * Samples added on other threads just mark it due, and it is written with
+ * the next sample on the logger's thread or when that thread calls
+ * reportIfDue()
+ * */
+class Profiler {
+public:
+  static constexpr int MAX_LABELS = 256;
+
+  /**
+   * Running totals for a single label
+   * */
+  class Slot {
+  public:
+    inline void record(uint64_t nanoseconds) {
+      count.fetch_add(1, std::memory_order_relaxed);
+      total.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+      uint64_t current = min.load(std::memory_order_relaxed);
+      while (nanoseconds < current &&
+             !min.compare_exchange_weak(current, nanoseconds,
+                                        std::memory_order_relaxed)) {
+      }
+
+      current = max.load(std::memory_order_relaxed);
+      while (nanoseconds > current &&
+             !max.compare_exchange_weak(current, nanoseconds,
+                                        std::memory_order_relaxed)) {
+      }
+
+      if (owner->reportInterval.load(std::memory_order_relaxed)) {
+        owner->sampleAdded();
+      }
+    }
+
+  private:
+    friend class Profiler;
+
+    void reset() {
+      count.store(0, std::memory_order_relaxed);
+      total.store(0, std::memory_order_relaxed);
+      min.store(UINT64_MAX, std::memory_order_relaxed);
+      max.store(0, std::memory_order_relaxed);
+    }
+
+    Profiler *owner = nullptr;
+    std::atomic<const char *> label{nullptr};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> min{UINT64_MAX};
+    std::atomic<uint64_t> max{0};
+  };
+
+  Profiler(DebugLogger &logger)
+      : logger(logger), loggerThread(std::this_thread::get_id()) {
+    for (int i = 0; i < MAX_LABELS; ++i) {
+      slots[i].owner = this;
+    }
+
+    overflow.owner = this;
+    overflow.label.store("(other labels)", std::memory_order_relaxed);
+  }
+
+  ~Profiler() {
+    if (reportOnShutdown) {
+      report(reportLevel);
+    }
+  }
+
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  /**
+   * Finds the slot for a label, claiming a new one the first time it is seen
+   * Samples for labels that don't fit in the table go to one shared slot
+   * */
+  Slot &slot(const char *label) {
+    uint32_t hash = hashLabel(label);
+
+    for (int probe = 0; probe < MAX_LABELS; ++probe) {
+      Slot &candidate = slots[(hash + probe) % MAX_LABELS];
+      const char *current = candidate.label.load(std::memory_order_acquire);
+
+      if (current == nullptr) {
+        if (candidate.label.compare_exchange_strong(
+                current, label, std::memory_order_acq_rel)) {
+          return candidate;
+        }
+      }
+
+      // same pointer or another copy of the same text
+      if (current == label || strcmp(current, label) == 0) {
+        return candidate;
+      }
+    }
+
+    return overflow;
+  }
+
+  /**
+   * Adds a sample to the label
+   * */
+  void record(const char *label, uint64_t nanoseconds) {
+    slot(label).record(nanoseconds);
+  }
+
+  /**
+   * Returns every label with samples sorted by total time, largest first
+   * */
+  std::vector<ProfileEntry> snapshot() const {
+    std::vector<ProfileEntry> entries;
+
+    for (int i = 0; i <= MAX_LABELS; ++i) {
+      const Slot &s = (i == MAX_LABELS) ? overflow : slots[i];
+      uint64_t count = s.count.load(std::memory_order_relaxed);
+      const char *label = s.label.load(std::memory_order_acquire);
+
+      if (label == nullptr || count == 0) {
+        continue;
+      }
+
+      ProfileEntry entry;
+      entry.label = label;
+      entry.count = count;
+      entry.total = s.total.load(std::memory_order_relaxed);
+      entry.min = s.min.load(std::memory_order_relaxed);
+      entry.max = s.max.load(std::memory_order_relaxed);
+      entry.mean = (double)entry.total / (double)count;
+      entries.push_back(entry);
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              [](const ProfileEntry &a, const ProfileEntry &b) {
+                return a.total > b.total;
+              });
+    return entries;
+  }
+
+  /**
+   * Writes one line per label through the logger, sorted by total time
+   * @param lev the level the report is logged on
+   * */
+  void report(Level lev = Level::LEVEL_TRACE) {
+    std::vector<ProfileEntry> entries = snapshot();
+
+    logger.logToLevel(lev, "profile: {ulong} labels", (uint64_t)entries.size());
+
+    for (const ProfileEntry &entry : entries) {
+      logger.logToLevel(
+          lev,
+          "profile {30str} count {>10ulong} total {>12.3f}ms mean {>10.3f}us "
+          "min {>10.3f}us max {>10.3f}us",
+          entry.label, entry.count, entry.total / 1e6, entry.mean / 1e3,
+          entry.min / 1e3, entry.max / 1e3);
+    }
+  }
+
+  /**
+   * Writes the report every interval, checked whenever a sample is added
+   * @param nanoseconds the time between reports, 0 turns it off
+   * */
+  void setReportInterval(uint64_t nanoseconds,
+                         Level lev = Level::LEVEL_TRACE) {
+    reportLevel = lev;
+    nextReport.store(clock.nanoseconds() + nanoseconds,
+                     std::memory_order_relaxed);
+    reportInterval.store(nanoseconds, std::memory_order_relaxed);
+  }
+
+  /**
+   * Writes the report if the report interval has passed, call it only from
+   * the logger's thread
+   * */
+  void reportIfDue() {
+    markIfDue();
+
+    if (reportDue.exchange(false, std::memory_order_relaxed)) {
+      report(reportLevel);
+    }
+  }
+
+  /**
+   * Makes the calling thread the one that writes the interval reports, for
+   * when the logger is used by another thread than the one that made the
+   * profiler
+   * */
+  void setLoggerThread() { loggerThread = std::this_thread::get_id(); }
+
+  void setReportOnShutdown(bool enabled, Level lev = Level::LEVEL_TRACE) {
+    reportOnShutdown = enabled;
+    reportLevel = lev;
+  }
+
+  /**
+   * Clears the samples but keeps the labels
+   * */
+  void reset() {
+    for (int i = 0; i < MAX_LABELS; ++i) {
+      slots[i].reset();
+    }
+
+    overflow.reset();
+  }
+
+private:
+  /**
+   * Marks the report due once the interval has passed, only one caller wins
+   * when several threads see it at once
+   * */
+  void markIfDue() {
+    uint64_t interval = reportInterval.load(std::memory_order_relaxed);
+    uint64_t now = clock.nanoseconds();
+    uint64_t due = nextReport.load(std::memory_order_relaxed);
+
+    if (interval && now >= due &&
+        nextReport.compare_exchange_strong(due, now + interval,
+                                           std::memory_order_relaxed)) {
+      reportDue.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Called after every sample while the interval report is on
+   * */
+  void sampleAdded() {
+    if (std::this_thread::get_id() == loggerThread) {
+      reportIfDue();
+    } else {
+      markIfDue();
+    }
+  }
+
+  static uint32_t hashLabel(const char *label) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+
+    while (*label) {
+      hash = (hash ^ (unsigned char)*label++) * 16777619u;
+    }
+
+    return hash;
+  }
+
+  DebugLogger &logger;
+  Slot slots[MAX_LABELS];
+  Slot overflow;
+
+  // measures time since the profiler was created for the report interval
+  Timer clock;
+  std::atomic<uint64_t> reportInterval{0};
+  std::atomic<uint64_t> nextReport{0};
+  std::atomic<bool> reportDue{false};
+  std::thread::id loggerThread;
+  Level reportLevel = Level::LEVEL_TRACE;
+  bool reportOnShutdown = false;
+};
+
+/**
+ * Times the scope it lives in and adds the sample to a profiler label
+ * {
+ *   ScopedTimer t(profiler, "parse");
+ *   ...
+ * }
+ * */
+class ScopedTimer {
+public:
+  ScopedTimer(Profiler &profiler, const char *label)
+      : slot(profiler.slot(label)) {}
+
+  ScopedTimer(Profiler::Slot &slot) : slot(slot) {}
+
+  ~ScopedTimer() { slot.record(timer.nanoseconds()); }
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+  Profiler::Slot &slot;
+  Timer timer;
+};
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+
+/**
+ * Times the rest of the scope, looking the label up only the first time the
+ * line runs. The profiler must be the same object every time
+ * */
+#define PROFILE_SCOPE(profiler, label)                                        \
+  static Profiler::Slot &PROFILER_CONCAT(profileSlot_, __LINE__) =           \
+      (profiler).slot(label);                                                 \
+  ScopedTimer PROFILER_CONCAT(profileTimer_, __LINE__)(                       \
+      PROFILER_CONCAT(profileSlot_, __LINE__))
+
+#endif
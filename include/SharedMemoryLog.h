@@ -0,0 +1,542 @@
+#ifndef INCLUDE_SHARED_MEMORY_LOG_H
+#define INCLUDE_SHARED_MEMORY_LOG_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <new>
+#include <signal.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "LogRing.h"
+#include "LogSink.h"
+#include "Timer.h"
+
+/**
+ * Shared memory segment that lets processes on one host log into rings a
+ * collector process drains, without a system call per line
+ *
+ * segment:
+ *   header: "DLSM" magic, version, slot count, collector pid, ring size,
+ *   ready flag
+ *   slots, one per producer, each on its own cache lines:
+ *     state (free, in use, closed), producer pid, dropped line count,
+ *     count of lines too big for the ring, head, tail
+ *   rings, ring size bytes per slot, records as in LogRing
+ * The collector creates the segment, producers attach to it and claim a
+ * free slot. One collector owns a segment at a time, it claims the segment
+ * by swapping its pid into the header. A slot is freed by the collector once its producer closed it
+ * or died and its ring is empty
+ * POSIX only
+ * */
+namespace SharedMemoryLog {
+constexpr char MAGIC[4] = {'D', 'L', 'S', 'M'};
+constexpr uint32_t VERSION = 2;
+constexpr uint32_t SLOT_FREE = 0;
+constexpr uint32_t SLOT_IN_USE = 1;
+constexpr uint32_t SLOT_CLOSED = 2;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t slotCount;
+
+  // pid of the collector that owns the segment, 0 if none
+  std::atomic<int32_t> collector;
+  uint64_t ringSize;
+  std::atomic<uint32_t> ready;
+};
+
+struct alignas(64) Slot {
+  std::atomic<uint32_t> state;
+  std::atomic<int32_t> pid;
+  std::atomic<uint64_t> dropped;
+  std::atomic<uint64_t> oversized;
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+};
+
+inline size_t slotsOffset() { return (sizeof(Header) + 63) & ~(size_t)63; }
+
+inline size_t ringsOffset(uint32_t slotCount) {
+  return slotsOffset() + slotCount * sizeof(Slot);
+}
+
+inline size_t segmentSize(uint32_t slotCount, uint64_t ringSize) {
+  return ringsOffset(slotCount) + slotCount * ringSize;
+}
+
+/**
+ * Names given to shm_open start with a slash, one is added if missing
+ * */
+inline std::string segmentName(const char *name) {
+  return name[0] == '/' ? std::string(name) : "/" + std::string(name);
+}
+
+/**
+ * A mapped segment, shared by the producer and the collector side
+ * */
+class Segment {
+public:
+  ~Segment() {
+    if (owned) {
+      int32_t pid = (int32_t)getpid();
+      header().collector.compare_exchange_strong(pid, 0,
+                                                 std::memory_order_release);
+    }
+
+    unmap();
+  }
+
+  bool isOpen() const { return base != nullptr; }
+
+  Header &header() const { return *(Header *)base; }
+
+  Slot &slot(uint32_t index) const {
+    return ((Slot *)(base + slotsOffset()))[index];
+  }
+
+  LogRing::View ring(uint32_t index) const {
+    Slot &s = slot(index);
+    return {&s.head, &s.tail,
+            base + ringsOffset(header().slotCount) +
+                index * header().ringSize,
+            (size_t)header().ringSize};
+  }
+
+  uint32_t slotCount() const { return header().slotCount; }
+
+  /**
+   * Maps an existing segment made by a collector
+   * */
+  bool attach(const char *name) {
+    int descriptor = shm_open(segmentName(name).c_str(), O_RDWR, 0);
+    struct stat info;
+
+    if (descriptor < 0) {
+      return false;
+    }
+
+    bool mapped = fstat(descriptor, &info) == 0 &&
+                  (size_t)info.st_size >= sizeof(Header) &&
+                  map(descriptor, (size_t)info.st_size);
+    ::close(descriptor);
+
+    if (!mapped || !valid()) {
+      unmap();
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+   * Maps the segment as its collector, making it if it doesn't exist yet or
+   * has a different layout. An existing segment with the same layout keeps
+   * its lines, so a restarted collector picks up where it stopped
+   * @return false if another collector that is still running owns the
+   * segment
+   * */
+  bool create(const char *name, uint32_t slotCount, uint64_t ringSize) {
+    if (attach(name)) {
+      if (!claim()) {
+        unmap();
+        return false;
+      }
+
+      if (header().slotCount == slotCount && header().ringSize == ringSize) {
+        return true;
+      }
+
+      owned = false;
+
+      unmap();
+      shm_unlink(segmentName(name).c_str());
+    }
+
+    int descriptor = shm_open(segmentName(name).c_str(), O_RDWR | O_CREAT,
+                              0600);
+
+    if (descriptor < 0) {
+      return false;
+    }
+
+    size_t size = segmentSize(slotCount, ringSize);
+    bool mapped = ftruncate(descriptor, (off_t)size) == 0 &&
+                  map(descriptor, size);
+    ::close(descriptor);
+
+    if (!mapped) {
+      unmap();
+      return false;
+    }
+
+    Header *h = new (base) Header();
+    memcpy(h->magic, MAGIC, 4);
+    h->version = VERSION;
+    h->slotCount = slotCount;
+    h->collector.store((int32_t)getpid());
+    h->ringSize = ringSize;
+
+    for (uint32_t i = 0; i < slotCount; ++i) {
+      Slot *s = new (&slot(i)) Slot();
+      s->state.store(SLOT_FREE);
+      s->pid.store(0);
+      s->dropped.store(0);
+      s->oversized.store(0);
+      s->head.store(0);
+      s->tail.store(0);
+    }
+
+    h->ready.store(1, std::memory_order_release);
+    owned = true;
+    return true;
+  }
+
+private:
+  /**
+   * Takes the segment over from a collector that exited or died
+   * @return false if its collector is still running
+   * */
+  bool claim() {
+    int32_t pid = (int32_t)getpid();
+    int32_t owner = header().collector.load(std::memory_order_acquire);
+
+    do {
+      bool alive = owner != 0 && (kill(owner, 0) == 0 || errno != ESRCH);
+
+      if (alive) {
+        return false;
+      }
+    } while (!header().collector.compare_exchange_weak(
+        owner, pid, std::memory_order_acq_rel));
+
+    owned = true;
+    return true;
+  }
+
+  bool map(int descriptor, size_t size) {
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        descriptor, 0);
+
+    if (memory == MAP_FAILED) {
+      return false;
+    }
+
+    base = (char *)memory;
+    mappedSize = size;
+    return true;
+  }
+
+  void unmap() {
+    if (base) {
+      munmap(base, mappedSize);
+      base = nullptr;
+    }
+  }
+
+  bool valid() const {
+    const Header &h = header();
+    return memcmp(h.magic, MAGIC, 4) == 0 && h.version == VERSION &&
+           h.ready.load(std::memory_order_acquire) == 1 && h.slotCount > 0 &&
+           h.ringSize >= 64 && (h.ringSize & (h.ringSize - 1)) == 0 &&
+           segmentSize(h.slotCount, h.ringSize) <= mappedSize;
+  }
+
+  char *base = nullptr;
+  size_t mappedSize = 0;
+
+  // set on the collector side once the segment is claimed
+  bool owned = false;
+};
+} // namespace SharedMemoryLog
+
+/**
+ * Sends lines to a collector process through a ring in shared memory
+ * Writing a line is a copy into the ring, no system call
+ * When the ring is full the sink waits up to maxWaitNanoseconds for the
+ * collector, then drops the line and counts it, so a stalled or missing
+ * collector never blocks the process for long. A line too big for the
+ * ring is dropped right away and counted on its own
+ * Each sink is a single producer, use one per logger and keep a logger on
+ * one thread at a time
+ * */
+class SharedMemorySink : public LogSink {
+public:
+  /**
+   * Attaches to the segment a collector made under name and claims a slot
+   * check isOpen(), the sink drops everything if there was none
+   * @param maxWaitNanoseconds how long a full ring is waited on, 0 drops
+   * lines right away
+   * */
+  explicit SharedMemorySink(const char *name, uint64_t maxWaitNanoseconds = 0)
+      : maxWait(maxWaitNanoseconds) {
+    if (!segment.attach(name)) {
+      return;
+    }
+
+    for (uint32_t i = 0; i < segment.slotCount(); ++i) {
+      uint32_t state = SharedMemoryLog::SLOT_FREE;
+
+      if (segment.slot(i).state.compare_exchange_strong(
+              state, SharedMemoryLog::SLOT_IN_USE,
+              std::memory_order_acquire)) {
+        segment.slot(i).pid.store((int32_t)getpid(),
+                                  std::memory_order_relaxed);
+        slot = (int)i;
+        ring = segment.ring(i);
+        return;
+      }
+    }
+  }
+
+  ~SharedMemorySink() {
+    if (slot >= 0) {
+      segment.slot((uint32_t)slot).state.store(SharedMemoryLog::SLOT_CLOSED,
+                                               std::memory_order_release);
+    }
+  }
+
+  SharedMemorySink(const SharedMemorySink &) = delete;
+  SharedMemorySink &operator=(const SharedMemorySink &) = delete;
+
+  bool isOpen() const { return slot >= 0; }
+
+  void write(const char *data, size_t size) override {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    LogMessageInfo info = {(int64_t)now.tv_sec * 1000000000 + now.tv_nsec, 0,
+                           nullptr};
+    writeMessage(data, size, info);
+  }
+
+  void writeMessage(const char *data, size_t size,
+                    const LogMessageInfo &info) override {
+    if (slot >= 0 && LogRing::recordSize(size) > ring.capacity) {
+      oversized++;
+      segment.slot((uint32_t)slot)
+          .oversized.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    writing.store(true);
+
+    if (slot < 0 || !(LogRing::write(ring, data, size, info) ||
+                      waitAndWrite(data, size, info))) {
+      countDropped();
+    }
+
+    writing.store(false);
+  }
+
+  /**
+   * Lines already in the ring survive the process, only the marker line of
+   * a fatal signal needs writing
+   * The ring has a single producer, so a marker for a signal that arrived
+   * while a line was being written is dropped and counted instead
+   * */
+  void writeFromSignal(const char *data, size_t size) override {
+    if (writing.load()) {
+      countDropped();
+      return;
+    }
+
+    write(data, size);
+  }
+
+  /**
+   * Returns the lines this sink dropped because the ring was full
+   * */
+  uint64_t getDroppedCount() const { return dropped; }
+
+  /**
+   * Returns the lines this sink dropped because they can't fit in the ring
+   * */
+  uint64_t getOversizedCount() const { return oversized; }
+
+private:
+  void countDropped() {
+    dropped++;
+
+    if (slot >= 0) {
+      segment.slot((uint32_t)slot)
+          .dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  bool waitAndWrite(const char *data, size_t size, const LogMessageInfo &info) {
+    if (maxWait == 0) {
+      return false;
+    }
+
+    Timer waited;
+
+    do {
+      std::this_thread::yield();
+
+      if (LogRing::write(ring, data, size, info)) {
+        return true;
+      }
+    } while (waited.nanoseconds() < maxWait);
+
+    return false;
+  }
+
+  SharedMemoryLog::Segment segment;
+  uint64_t maxWait;
+  LogRing::View ring = {};
+  int slot = -1;
+  uint64_t dropped = 0;
+  uint64_t oversized = 0;
+
+  // set while writeMessage is using the ring, checked by writeFromSignal
+  std::atomic<bool> writing{false};
+};
+
+/**
+ * Drains the rings of a shared memory segment into a sink, in timestamp
+ * order across producers, see DebugLoggerCollector
+ * The lines reach the sink without a format, the producers' format strings
+ * mean nothing in this process, so an IndexedFileSink gives them format id 0
+ * */
+class SharedMemoryCollector {
+public:
+  /**
+   * Makes the segment producers attach to
+   * @return false if it can't be made or another collector is using it
+   * @param ringSize bytes per producer, rounded up to a power of two
+   * */
+  bool create(const char *name, uint32_t producers = 64,
+              uint64_t ringSize = 1 << 20) {
+    uint64_t rounded = 64;
+
+    while (rounded < ringSize) {
+      rounded <<= 1;
+    }
+
+    this->name = SharedMemoryLog::segmentName(name);
+    return segment.create(name, producers, rounded);
+  }
+
+  /**
+   * Removes the segment name, mapped segments stay until they are unmapped
+   * */
+  void unlink() { shm_unlink(name.c_str()); }
+
+  /**
+   * Writes the lines logged at or before cutoff to the target, then frees
+   * the slots of producers that closed or died
+   * A producer's dropped lines are reported with a line of their own, apart
+   * from the lines that were too big for its ring
+   * @return the number of lines written
+   * */
+  size_t drain(LogSink &target, int64_t cutoff) {
+    uint32_t count = segment.slotCount();
+    rings.clear();
+
+    for (uint32_t i = 0; i < count; ++i) {
+      if (segment.slot(i).state.load(std::memory_order_acquire) !=
+          SharedMemoryLog::SLOT_FREE) {
+        rings.push_back(segment.ring(i));
+      }
+    }
+
+    size_t written =
+        merger.merge(rings.data(), (int)rings.size(), cutoff, target, false);
+
+    for (uint32_t i = 0; i < count; ++i) {
+      reportDropped(target, i);
+      releaseIfDone(i);
+    }
+
+    return written;
+  }
+
+  /**
+   * Time of the newest line of the producer that is furthest behind, lines
+   * up to it can be drained in order without waiting
+   * @param idleBound stands in for producers with nothing staged, see
+   * LogRing::watermark
+   * */
+  int64_t watermark(int64_t idleBound) {
+    rings.clear();
+
+    for (uint32_t i = 0; i < segment.slotCount(); ++i) {
+      if (segment.slot(i).state.load(std::memory_order_acquire) ==
+          SharedMemoryLog::SLOT_IN_USE) {
+        rings.push_back(segment.ring(i));
+      }
+    }
+
+    return LogRing::watermark(rings.data(), (int)rings.size(), idleBound);
+  }
+
+private:
+  void reportDropped(LogSink &target, uint32_t index) {
+    SharedMemoryLog::Slot &slot = segment.slot(index);
+    uint64_t dropped = slot.dropped.exchange(0, std::memory_order_relaxed);
+    uint64_t oversized =
+        slot.oversized.exchange(0, std::memory_order_relaxed);
+
+    if (dropped) {
+      std::string line = "collector: dropped " + std::to_string(dropped) +
+                         " lines from process " +
+                         std::to_string(slot.pid.load()) + "\n";
+      target.write(line.data(), line.size());
+    }
+
+    if (oversized) {
+      std::string line = "collector: dropped " + std::to_string(oversized) +
+                         " lines too big for the ring from process " +
+                         std::to_string(slot.pid.load()) + "\n";
+      target.write(line.data(), line.size());
+    }
+  }
+
+  /**
+   * Frees a slot whose producer is gone once its ring is empty
+   * A producer that died can leave a half written line, which is skipped
+   * */
+  void releaseIfDone(uint32_t index) {
+    SharedMemoryLog::Slot &slot = segment.slot(index);
+    uint32_t state = slot.state.load(std::memory_order_acquire);
+
+    if (state == SharedMemoryLog::SLOT_FREE) {
+      return;
+    }
+
+    bool alive = state == SharedMemoryLog::SLOT_IN_USE &&
+                 (kill(slot.pid.load(), 0) == 0 || errno != ESRCH);
+
+    if (alive) {
+      return;
+    }
+
+    LogRing::View ring = segment.ring(index);
+    LogRing::Record record;
+    uint64_t tail = ring.tail->load(std::memory_order_relaxed);
+
+    if (LogRing::read(ring, tail, record)) {
+      return;
+    }
+
+    ring.tail->store(ring.head->load(std::memory_order_acquire),
+                     std::memory_order_release);
+    slot.pid.store(0, std::memory_order_relaxed);
+    slot.state.store(SharedMemoryLog::SLOT_FREE, std::memory_order_release);
+  }
+
+  SharedMemoryLog::Segment segment;
+  std::string name;
+  std::vector<LogRing::View> rings;
+  LogRing::Merger merger;
+};
+
+#endif
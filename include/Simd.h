@@ -0,0 +1,15 @@
+#ifndef INCLUDE_SIMD_H
+#define INCLUDE_SIMD_H
+
+/**
+ * Defines DEBUG_LOGGER_SSE2 and includes the SSE2 intrinsics when the target
+ * has them, every x86-64 target and 32 bit builds that enable SSE2
+ * The kernels that use them keep a portable path for other targets
+ * */
+#if defined(__SSE2__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DEBUG_LOGGER_SSE2
+#endif
+
+#endif
@@ -0,0 +1,512 @@
+#ifndef INCLUDE_SOCKET_SINK_H
+#define INCLUDE_SOCKET_SINK_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "LogSink.h"
+#include "Timer.h"
+
+/**
+ * Sends lines to a local collector over a Unix domain socket, many lines
+ * per send
+ * Lines collect in a batch that is sent when it fills up or when its first
+ * line is older than the flush interval
+ *
+ * While the collector can't be reached, or can't keep up, batches are
+ * appended to a spool file instead of piling up in memory. The spool is
+ * sent, oldest first, once the collector is back, and before any newer
+ * batch, so lines arrive in order. A spool left by an earlier run is sent
+ * too. A batch cut off by a lost stream connection is sent again whole, so
+ * the collector gets every record complete on the new connection, and the
+ * lines it already got from that batch are duplicated
+ *
+ * Framing::TEXT sends the lines as they are
+ * Framing::RECORDS puts a header in front of each line: line size (4 bytes),
+ * level (4), unix time in nanoseconds (8), in the byte order of the host
+ * With a datagram socket every batch is one datagram
+ * POSIX only
+ * */
+class SocketSink : public LogSink {
+public:
+  enum class Framing { TEXT, RECORDS };
+
+  static constexpr size_t RECORD_HEADER_SIZE = 16;
+
+  /**
+   * @param spoolPath file for the batches that couldn't be sent, nullptr to
+   * drop them instead
+   * @param socketType SOCK_STREAM or SOCK_DGRAM
+   * @param batchSize the most bytes sent at once, datagrams must fit in the
+   * socket's buffer
+   * @param flushIntervalNanoseconds the longest a line waits in the batch
+   * */
+  SocketSink(const char *socketPath, const char *spoolPath,
+             Framing framing = Framing::TEXT, int socketType = SOCK_STREAM,
+             size_t batchSize = 1 << 15,
+             uint64_t flushIntervalNanoseconds = 100000000)
+      : socketPath(socketPath), framing(framing), socketType(socketType),
+        capacity(batchSize > RECORD_HEADER_SIZE ? batchSize
+                                                : RECORD_HEADER_SIZE + 1),
+        interval(flushIntervalNanoseconds), batch(new char[capacity]),
+        used(0) {
+    if (spoolPath) {
+      spool = ::open(spoolPath, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      struct stat info;
+
+      if (spool >= 0 && fstat(spool, &info) == 0) {
+        spoolEnd = (uint64_t)info.st_size;
+      }
+    }
+
+    flusher = std::thread(&SocketSink::run, this);
+  }
+
+  /**
+   * Sends what is left, waiting up to a second for the collector, anything
+   * still unsent stays in the spool
+   * */
+  ~SocketSink() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+
+    wake.notify_all();
+    flusher.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    submitBatch();
+
+    for (int i = 0; i < 1000 && hasBacklog(); ++i) {
+      retryAt = 0;
+      sendBacklog();
+
+      if (hasBacklog()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+
+    // goes behind anything still spooled, the only case that reorders lines
+    if (!outgoing.empty() && outgoingSent == 0) {
+      appendSpool(outgoing.data(), outgoing.size());
+    } else if (!outgoing.empty()) {
+      droppedBytes += outgoing.size() - outgoingSent;
+    }
+
+    if (connection >= 0) {
+      ::close(connection);
+    }
+
+    if (spool >= 0) {
+      ::close(spool);
+    }
+  }
+
+  SocketSink(const SocketSink &) = delete;
+  SocketSink &operator=(const SocketSink &) = delete;
+
+  void write(const char *data, size_t size) override {
+    LogMessageInfo info = {Timer::unixNow(), 0, nullptr};
+    writeMessage(data, size, info);
+  }
+
+  void writeMessage(const char *data, size_t size,
+                    const LogMessageInfo &info) override {
+    size_t header = framing == Framing::RECORDS ? RECORD_HEADER_SIZE : 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t current = used.load(std::memory_order_relaxed);
+
+    if (header + size > capacity - current) {
+      submitBatch();
+      current = 0;
+    }
+
+    // a line bigger than a batch is sent on its own
+    if (header + size > capacity) {
+      std::vector<char> record(header + size);
+      encodeHeader(record.data(), size, info);
+      memcpy(record.data() + header, data, size);
+      enqueue(record.data(), record.size());
+      return;
+    }
+
+    if (current == 0) {
+      batchStarted = Timer::unixNow();
+    }
+
+    if (header) {
+      encodeHeader(batch.get() + current, size, info);
+    }
+
+    memcpy(batch.get() + current + header, data, size);
+    used.store(current + header + size, std::memory_order_release);
+  }
+
+  /**
+   * Sends the batch and as much of the backlog as the collector takes
+   * without waiting
+   * */
+  void flush() override {
+    std::lock_guard<std::mutex> lock(mutex);
+    submitBatch();
+    sendBacklog();
+  }
+
+  /**
+   * Appends the batch to the spool, or sends it if there is no spool
+   * */
+  void flushFromSignal() override {
+    size_t size = used.exchange(0, std::memory_order_acquire);
+
+    if (size) {
+      sendFromSignal(batch.get(), size);
+    }
+  }
+
+  /**
+   * Sends the text as a line of its own, with a level 0 header when the
+   * framing has records
+   * */
+  void writeFromSignal(const char *data, size_t size) override {
+    if (framing != Framing::RECORDS) {
+      sendFromSignal(data, size);
+      return;
+    }
+
+    char record[RECORD_HEADER_SIZE + 1024];
+    size = std::min(size, sizeof(record) - RECORD_HEADER_SIZE);
+    LogMessageInfo info = {Timer::unixNow(), 0, nullptr};
+    encodeHeader(record, size, info);
+    memcpy(record + RECORD_HEADER_SIZE, data, size);
+    sendFromSignal(record, RECORD_HEADER_SIZE + size);
+  }
+
+  bool isConnected() const { return connection >= 0; }
+
+  /**
+   * Returns the bytes the collector received
+   * */
+  uint64_t getSentBytes() const { return sentBytes.load(); }
+
+  /**
+   * Returns the bytes written to the spool because they couldn't be sent
+   * */
+  uint64_t getSpooledBytes() const { return spooledBytes.load(); }
+
+  /**
+   * Returns the bytes dropped, with no spool or with a full spool
+   * */
+  uint64_t getDroppedBytes() const { return droppedBytes.load(); }
+
+  /**
+   * Sets the largest the spool may grow before batches are dropped
+   * */
+  void setSpoolLimit(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    spoolLimit = bytes;
+  }
+
+private:
+  static constexpr int64_t RETRY_NANOSECONDS = 1000000000;
+
+  /**
+   * Appends framed data to the spool, or sends it if there is no spool
+   * Only calls pwrite() or send(), so it is async-signal-safe
+   * */
+  void sendFromSignal(const char *data, size_t size) {
+    if (spool >= 0) {
+      // sent when the program next starts
+      uint32_t length = (uint32_t)size;
+      ssize_t ignored =
+          ::pwrite(spool, &length, sizeof(length), (off_t)spoolEnd);
+      ignored = ::pwrite(spool, data, size,
+                         (off_t)(spoolEnd + sizeof(length)));
+      (void)ignored;
+      spoolEnd += sizeof(length) + size;
+    } else if (connection >= 0) {
+      ssize_t ignored = ::send(connection, data, size, MSG_NOSIGNAL);
+      (void)ignored;
+    }
+  }
+
+  void encodeHeader(char *header, size_t size, const LogMessageInfo &info) {
+    if (framing != Framing::RECORDS) {
+      return;
+    }
+
+    uint32_t size32 = (uint32_t)size;
+    int32_t level = info.level;
+    memcpy(header, &size32, 4);
+    memcpy(header + 4, &level, 4);
+    memcpy(header + 8, &info.unixNanoseconds, 8);
+  }
+
+  bool hasBacklog() const {
+    return !outgoing.empty() || spoolStart < spoolEnd;
+  }
+
+  void submitBatch() {
+    size_t size = used.load(std::memory_order_relaxed);
+
+    if (size) {
+      enqueue(batch.get(), size);
+      used.store(0, std::memory_order_release);
+    }
+  }
+
+  /**
+   * Sends the data right away if nothing older is waiting, otherwise it
+   * joins the spool behind the older data
+   * */
+  void enqueue(const char *data, size_t size) {
+    sendBacklog();
+
+    if (!hasBacklog() && connect()) {
+      outgoing.assign(data, data + size);
+      outgoingSent = 0;
+      sendOutgoing();
+
+      if (outgoing.empty() || outgoingSent > 0 || connection >= 0) {
+        return;
+      }
+
+      // refused before any of it went out, it waits in the spool instead
+      outgoing.clear();
+    }
+
+    appendSpool(data, size);
+  }
+
+  /**
+   * Sends waiting data, oldest first, until the collector stops taking it
+   * */
+  void sendBacklog() {
+    while (hasBacklog() && connect()) {
+      if (outgoing.empty() && !loadSpooled()) {
+        return;
+      }
+
+      sendOutgoing();
+
+      if (!outgoing.empty()) {
+        return;
+      }
+    }
+  }
+
+  /**
+   * Moves the oldest spooled batch to outgoing
+   * */
+  bool loadSpooled() {
+    uint32_t length;
+
+    if (spoolEnd - spoolStart < sizeof(length) ||
+        ::pread(spool, &length, sizeof(length), (off_t)spoolStart) !=
+            sizeof(length) ||
+        length > spoolEnd - spoolStart - sizeof(length)) {
+      // a torn batch at the end, from a crash while spooling
+      resetSpool();
+      return false;
+    }
+
+    outgoing.resize(length);
+
+    if (::pread(spool, outgoing.data(), length,
+                (off_t)(spoolStart + sizeof(length))) != (ssize_t)length) {
+      outgoing.clear();
+      resetSpool();
+      return false;
+    }
+
+    outgoingSent = 0;
+    spoolStart += sizeof(length) + length;
+
+    if (spoolStart == spoolEnd) {
+      resetSpool();
+    }
+
+    return true;
+  }
+
+  void resetSpool() {
+    // if it can't shrink, writing over it from the start works as well
+    if (spool >= 0) {
+      int ignored = ftruncate(spool, 0);
+      (void)ignored;
+    }
+
+    spoolStart = spoolEnd = 0;
+  }
+
+  void appendSpool(const char *data, size_t size) {
+    uint32_t length = (uint32_t)size;
+
+    if (spool < 0 || spoolEnd + sizeof(length) + size > spoolLimit) {
+      droppedBytes += size;
+      return;
+    }
+
+    bool written =
+        ::pwrite(spool, &length, sizeof(length), (off_t)spoolEnd) ==
+            sizeof(length) &&
+        ::pwrite(spool, data, size, (off_t)(spoolEnd + sizeof(length))) ==
+            (ssize_t)size;
+
+    if (!written) {
+      droppedBytes += size;
+      return;
+    }
+
+    spoolEnd += sizeof(length) + size;
+    spooledBytes += size;
+  }
+
+  /**
+   * Sends what is left of outgoing without blocking
+   * */
+  void sendOutgoing() {
+    while (outgoingSent < outgoing.size()) {
+      ssize_t sent = ::send(connection, outgoing.data() + outgoingSent,
+                            outgoing.size() - outgoingSent,
+                            MSG_NOSIGNAL | MSG_DONTWAIT);
+
+      if (sent >= 0) {
+        outgoingSent += (size_t)sent;
+        sentBytes += (uint64_t)sent;
+        continue;
+      }
+
+      if (errno == EINTR) {
+        continue;
+      }
+
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+        return;
+      }
+
+      if (errno == EMSGSIZE) {
+        droppedBytes += outgoing.size();
+        break;
+      }
+
+      disconnect();
+      return;
+    }
+
+    outgoing.clear();
+    outgoingSent = 0;
+  }
+
+  /**
+   * Connects if not connected, trying at most once a second
+   * The socket doesn't block, a collector that is slow to accept counts as
+   * unavailable
+   * */
+  bool connect() {
+    if (connection >= 0) {
+      return true;
+    }
+
+    int64_t now = Timer::unixNow();
+
+    if (now < retryAt) {
+      return false;
+    }
+
+    retryAt = now + RETRY_NANOSECONDS;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(),
+            sizeof(address.sun_path) - 1);
+
+    connection = ::socket(AF_UNIX, socketType | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (connection >= 0 &&
+        ::connect(connection, (struct sockaddr *)&address, sizeof(address)) !=
+            0) {
+      disconnect();
+    }
+
+    return connection >= 0;
+  }
+
+  void disconnect() {
+    if (connection >= 0) {
+      ::close(connection);
+      connection = -1;
+    }
+
+    // sent again whole: the collector may have lost the end of it, and a
+    // new connection must start at a record, at the cost of duplicates
+    outgoingSent = 0;
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (running) {
+      wake.wait_for(lock, std::chrono::nanoseconds(interval / 2 + 1));
+
+      if (used.load(std::memory_order_relaxed) &&
+          Timer::unixNow() - batchStarted >= (int64_t)interval) {
+        submitBatch();
+      }
+
+      sendBacklog();
+    }
+  }
+
+  std::string socketPath;
+  Framing framing;
+  int socketType;
+  size_t capacity;
+  uint64_t interval;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool running = true;
+
+  // lines waiting for the next send
+  std::unique_ptr<char[]> batch;
+  std::atomic<size_t> used;
+  int64_t batchStarted = 0;
+
+  // data being sent, the collector has outgoingSent bytes of it
+  std::vector<char> outgoing;
+  size_t outgoingSent = 0;
+
+  int connection = -1;
+  int64_t retryAt = 0;
+
+  // spooled batches between spoolStart and spoolEnd, each after its length
+  int spool = -1;
+  uint64_t spoolStart = 0;
+  uint64_t spoolEnd = 0;
+  uint64_t spoolLimit = (uint64_t)1 << 30;
+
+  std::atomic<uint64_t> sentBytes{0};
+  std::atomic<uint64_t> spooledBytes{0};
+  std::atomic<uint64_t> droppedBytes{0};
+
+  std::thread flusher;
+};
+
+#endif
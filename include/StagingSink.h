@@ -0,0 +1,348 @@
+#ifndef INCLUDE_STAGING_SINK_H
+#define INCLUDE_STAGING_SINK_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "LogRing.h"
+#include "LogSink.h"
+#include "Timer.h"
+
+/**
+ * Lets many threads log to one sink without sharing anything per message
+ * Each thread copies its lines into a buffer of its own, and a background
+ * thread collects the buffers every interval and writes the lines to the
+ * target in timestamp order
+ * Give each thread its own DebugLogger (the logger itself is not thread
+ * safe) and point them all at the same StagingSink with setTargetSink
+ *
+ * Lines are held back for one interval before they are written, so a line
+ * only comes out of order if it was formatted more than an interval before
+ * its thread copied it. flush() writes everything that is staged
+ * The format strings of staged lines must stay valid until they are written
+ * */
+class StagingSink : public LogSink {
+public:
+  static constexpr int MAX_THREADS = 256;
+
+  /**
+   * @param target where the merged lines go, only written by one thread at
+   * a time
+   * @param threadBufferSize bytes staged per thread, a thread that fills its
+   * buffer waits for the merge
+   * @param intervalNanoseconds how often the buffers are merged
+   * */
+  StagingSink(LogSink &target, size_t threadBufferSize = 1 << 20,
+              uint64_t intervalNanoseconds = 10000000)
+      : target(target), bufferSize(roundUpToPowerOfTwo(threadBufferSize)),
+        interval(intervalNanoseconds), id(nextSinkId()),
+        merger(&StagingSink::run, this) {}
+
+  ~StagingSink() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+
+    wake.notify_all();
+    merger.join();
+    merge(INT64_MAX);
+    target.flush();
+  }
+
+  StagingSink(const StagingSink &) = delete;
+  StagingSink &operator=(const StagingSink &) = delete;
+
+  void write(const char *data, size_t size) override {
+    LogMessageInfo info = {Timer::unixNow(), 0, nullptr};
+    writeMessage(data, size, info);
+  }
+
+  void writeMessage(const char *data, size_t size,
+                    const LogMessageInfo &info) override {
+    ThreadBuffer *buffer = threadBuffer();
+
+    // no buffer left or too big to stage, written right away instead
+    if (!buffer || size > bufferSize / 4) {
+      std::lock_guard<std::mutex> lock(targetMutex);
+      target.writeMessage(data, size, info);
+      return;
+    }
+
+    LogRing::View ring = buffer->view(bufferSize);
+
+    while (!LogRing::write(ring, data, size, info)) {
+      stalls.fetch_add(1, std::memory_order_relaxed);
+      mergeRequested.store(true, std::memory_order_relaxed);
+      wake.notify_one();
+      std::this_thread::yield();
+    }
+  }
+
+  /**
+   * Writes every staged line, then flushes the target
+   * */
+  void flush() override {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint64_t generation = ++flushRequested;
+    wake.notify_all();
+    flushed.wait(lock, [&] { return flushDone >= generation || !running; });
+  }
+
+  /**
+   * Flushes the target, then writes the staged lines of every thread to it
+   * in timestamp order
+   * */
+  void flushFromSignal() override {
+    target.flushFromSignal();
+
+    uint64_t positions[MAX_THREADS];
+    LogRing::View rings[MAX_THREADS];
+    int count = bufferCount.load(std::memory_order_acquire);
+
+    for (int i = 0; i < count; ++i) {
+      rings[i] = buffers[i]->view(bufferSize);
+      positions[i] = rings[i].tail->load(std::memory_order_acquire);
+    }
+
+    while (true) {
+      int oldest = -1;
+      LogRing::Record oldestRecord = {};
+
+      for (int i = 0; i < count; ++i) {
+        LogRing::Record record;
+
+        if (LogRing::read(rings[i], positions[i], record) &&
+            (oldest < 0 ||
+             record.unixNanoseconds < oldestRecord.unixNanoseconds)) {
+          oldest = i;
+          oldestRecord = record;
+        }
+      }
+
+      if (oldest < 0) {
+        return;
+      }
+
+      target.writeFromSignal(oldestRecord.text, oldestRecord.size);
+      positions[oldest] = oldestRecord.next;
+    }
+  }
+
+  void writeFromSignal(const char *data, size_t size) override {
+    target.writeFromSignal(data, size);
+  }
+
+  /**
+   * Returns how many times a thread found its buffer full and had to wait
+   * for the merge, a growing count means the buffers are too small
+   * */
+  uint64_t getStallCount() const { return stalls.load(); }
+
+private:
+  /**
+   * Lines staged by one thread, that thread moves head and the merge moves
+   * tail
+   * */
+  struct ThreadBuffer {
+    explicit ThreadBuffer(size_t size) : data(new char[size]) {}
+
+    LogRing::View view(size_t size) { return {&head, &tail, data.get(), size}; }
+
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+
+    // cleared when the thread is done with it, another thread can take it
+    std::atomic<bool> owned{true};
+    std::unique_ptr<char[]> data;
+  };
+
+  /**
+   * The buffers a thread owns, released when the thread exits
+   * */
+  struct ThreadBuffers {
+    static constexpr int SIZE = 4;
+
+    ~ThreadBuffers() {
+      for (int i = 0; i < SIZE; ++i) {
+        if (buffers[i]) {
+          buffers[i]->owned.store(false, std::memory_order_release);
+        }
+      }
+    }
+
+    uint64_t sinkIds[SIZE] = {0};
+    std::shared_ptr<ThreadBuffer> buffers[SIZE];
+    int next = 0;
+  };
+
+  static size_t roundUpToPowerOfTwo(size_t size) {
+    size_t rounded = 64;
+
+    while (rounded < size) {
+      rounded <<= 1;
+    }
+
+    return rounded;
+  }
+
+  static uint64_t nextSinkId() {
+    static std::atomic<uint64_t> next{1};
+    return next++;
+  }
+
+  /**
+   * Finds the calling thread's buffer, taking a free one or making one the
+   * first time the thread writes to this sink
+   * */
+  ThreadBuffer *threadBuffer() {
+    thread_local ThreadBuffers owned;
+
+    for (int i = 0; i < ThreadBuffers::SIZE; ++i) {
+      if (owned.sinkIds[i] == id) {
+        return owned.buffers[i].get();
+      }
+    }
+
+    std::shared_ptr<ThreadBuffer> buffer = takeBuffer();
+
+    if (!buffer) {
+      return nullptr;
+    }
+
+    // a thread using more sinks than it keeps gives up its oldest buffer
+    int slot = owned.next;
+    owned.next = (slot + 1) % ThreadBuffers::SIZE;
+
+    if (owned.buffers[slot]) {
+      owned.buffers[slot]->owned.store(false, std::memory_order_release);
+    }
+
+    owned.sinkIds[slot] = id;
+    owned.buffers[slot] = buffer;
+    return buffer.get();
+  }
+
+  std::shared_ptr<ThreadBuffer> takeBuffer() {
+    std::lock_guard<std::mutex> lock(registerMutex);
+    int count = bufferCount.load(std::memory_order_relaxed);
+
+    for (int i = 0; i < count; ++i) {
+      bool free = false;
+
+      if (buffers[i]->owned.compare_exchange_strong(
+              free, true, std::memory_order_acquire)) {
+        return buffers[i];
+      }
+    }
+
+    if (count == MAX_THREADS) {
+      return nullptr;
+    }
+
+    buffers[count] = std::make_shared<ThreadBuffer>(bufferSize);
+    bufferCount.store(count + 1, std::memory_order_release);
+    return buffers[count];
+  }
+
+  /**
+   * Writes the staged lines logged at or before cutoff in timestamp order
+   * and frees their space
+   * */
+  void merge(int64_t cutoff) {
+    collectRings();
+    std::lock_guard<std::mutex> lock(targetMutex);
+    ringMerger.merge(rings.data(), (int)rings.size(), cutoff, target);
+  }
+
+  void collectRings() {
+    int count = bufferCount.load(std::memory_order_acquire);
+    rings.resize((size_t)count);
+
+    for (int i = 0; i < count; ++i) {
+      rings[i] = buffers[i]->view(bufferSize);
+    }
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (running) {
+      wake.wait_for(lock, std::chrono::nanoseconds(interval), [this] {
+        return !running || flushRequested > flushDone ||
+               mergeRequested.load(std::memory_order_relaxed);
+      });
+
+      uint64_t generation = flushRequested;
+      bool flushing = generation > flushDone;
+      bool full = mergeRequested.exchange(false, std::memory_order_relaxed);
+      lock.unlock();
+
+      // a full buffer can't wait for its lines to be held back
+      int64_t now = Timer::unixNow();
+      int64_t heldBack = now - (int64_t)interval;
+
+      if (flushing) {
+        merge(INT64_MAX);
+      } else if (full) {
+        collectRings();
+        merge(std::max(heldBack,
+                       std::min(now, LogRing::watermark(rings.data(),
+                                                        (int)rings.size(),
+                                                        heldBack))));
+      } else {
+        merge(heldBack);
+      }
+
+      if (flushing) {
+        std::lock_guard<std::mutex> targetLock(targetMutex);
+        target.flush();
+      }
+
+      lock.lock();
+
+      if (flushing) {
+        flushDone = generation;
+        flushed.notify_all();
+      }
+    }
+
+    flushed.notify_all();
+  }
+
+  LogSink &target;
+  size_t bufferSize;
+  uint64_t interval;
+  uint64_t id;
+
+  std::mutex registerMutex;
+  std::shared_ptr<ThreadBuffer> buffers[MAX_THREADS];
+  std::atomic<int> bufferCount{0};
+
+  // only used by the merge
+  std::vector<LogRing::View> rings;
+  LogRing::Merger ringMerger;
+
+  std::mutex targetMutex;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable flushed;
+  uint64_t flushRequested = 0;
+  uint64_t flushDone = 0;
+  std::atomic<bool> mergeRequested{false};
+  bool running = true;
+
+  std::atomic<uint64_t> stalls{0};
+
+  std::thread merger;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define INCLUDE_TIMER_H
 
 #include <chrono>
+#include <cstdint>
 
 /**
  * Class to handle time differentials
@@ -42,6 +43,24 @@ class Timer{
             return (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(now - prevTP).count();
         }
 
+        /**
+         * Returns the current time of the clock the timer uses in nanoseconds
+         * Used as a timestamp where an absolute time is needed
+         * */
+        static inline uint64_t now(){
+            auto now = std::chrono::high_resolution_clock::now();
+            return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+        }
+
+        /**
+         * Returns the wall clock time in nanoseconds since the unix epoch
+         * Used where times from different threads or processes are compared
+         * */
+        static inline int64_t unixNow(){
+            auto now = std::chrono::system_clock::now();
+            return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+        }
+
     private:
         std::chrono::high_resolution_clock::time_point prevTP;
 };
@@ -0,0 +1,439 @@
+#ifndef INCLUDE_TRACE_RECORDER_H
+#define INCLUDE_TRACE_RECORDER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "DebugLogger.h"
+#include "Timer.h"
+
+/**
+ * A single fixed size timeline record
+ * timestamp: Timer::now() when the event happened
+ * name: interned name id
+ * phase: 'B' begin, 'E' end or 'i' instant
+ * message: sequence number of the log line attached to the event, if any
+ * */
+struct TraceEvent {
+  uint64_t timestamp;
+  uint32_t name : 24;
+  uint32_t phase : 8;
+  uint32_t message;
+};
+
+/**
+ * Records begin/end spans and instant events into per-thread ring buffers
+ * and exports them as Chrome Trace Event json, which loads in
+ * chrome://tracing and Perfetto
+ * Names are interned once up front (TRACE_SPAN does that on the first run of
+ * a line), after which recording an event is a timestamp and a 16 byte store
+ * into the calling thread's own buffer with nothing formatted
+ * When a ring is full the oldest events of that thread are overwritten
+ * Attach a logger to put its messages on the same timeline as instant events,
+ * and detach it before the recorder is destroyed. The recorder never touches
+ * a logger after attaching it, so a logger can die while attached
+ * Export once recording has stopped, events being written while exporting
+ * can show up half written
+ * Name ids are 24 bits, names interned past MAX_NAME_ID share that id and
+ * are counted by getNameOverflowCount()
+ * */
+class TraceRecorder {
+public:
+  static constexpr uint32_t NO_MESSAGE = 0xffffffff;
+  static constexpr uint32_t MAX_NAME_ID = 0xffffff;
+  static constexpr size_t MESSAGE_SIZE = 128;
+
+  /**
+   * @param eventsPerThread ring size of each thread, rounded up to a power of 2
+   * @param messagesPerThread number of log lines kept per thread for attached
+   * loggers, rounded up to a power of 2
+   * */
+  TraceRecorder(size_t eventsPerThread = 1 << 16,
+                size_t messagesPerThread = 1024)
+      : id(nextRecorderId()), eventCapacity(roundUp(eventsPerThread)),
+        messageCapacity(roundUp(messagesPerThread)),
+        startTime(Timer::now()) {}
+
+  TraceRecorder(const TraceRecorder &) = delete;
+  TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+  /**
+   * Returns the id for a name, adding it the first time it is seen
+   * Takes a lock, so look names up once and keep the id
+   * */
+  uint32_t intern(const std::string &name) {
+    std::lock_guard<std::mutex> lock(namesLock);
+    std::unordered_map<std::string, uint32_t>::iterator found =
+        nameIds.find(name);
+
+    if (found != nameIds.end()) {
+      return found->second;
+    }
+
+    if (names.size() >= MAX_NAME_ID) {
+      nameOverflows.fetch_add(1, std::memory_order_relaxed);
+      return MAX_NAME_ID;
+    }
+
+    uint32_t nameId = (uint32_t)names.size();
+    names.push_back(name);
+    nameIds.emplace(name, nameId);
+    return nameId;
+  }
+
+  /**
+   * Returns the number of intern calls that got MAX_NAME_ID because every
+   * other id was taken
+   * */
+  uint64_t getNameOverflowCount() const {
+    return nameOverflows.load(std::memory_order_relaxed);
+  }
+
+  inline void begin(uint32_t nameId) { record(nameId, 'B', NO_MESSAGE); }
+
+  inline void end(uint32_t nameId) { record(nameId, 'E', NO_MESSAGE); }
+
+  inline void instant(uint32_t nameId) { record(nameId, 'i', NO_MESSAGE); }
+
+  /**
+   * Names the calling thread in the exported trace
+   * */
+  void setThreadName(const std::string &name) {
+    ThreadBuffer *buffer = localBuffer();
+    std::lock_guard<std::mutex> lock(threadsLock);
+    buffer->name = name;
+  }
+
+  /**
+   * Records every line the logger writes as an instant event named after its
+   * level, with the text of the line attached
+   * A logger has a single message hook, so this replaces any other hook
+   * The hook points at the recorder, so a logger that outlives the recorder
+   * must be detached first. Call it on the logger's own thread
+   * */
+  void attachLogger(DebugLogger &logger) {
+    {
+      // written once, hooks already running read them without the lock
+      std::lock_guard<std::mutex> lock(threadsLock);
+
+      if (!levelNamesSet) {
+        levelNameIds[(int)Level::LEVEL_TRACE] = intern("trace");
+        levelNameIds[(int)Level::LEVEL_WARNING] = intern("warning");
+        levelNameIds[(int)Level::LEVEL_ERROR] = intern("error");
+        levelNameIds[(int)Level::CRITICAL_ERROR] = intern("critical");
+        levelNamesSet = true;
+      }
+    }
+
+    logger.setMessageHook(&TraceRecorder::loggerHook, this);
+  }
+
+  /**
+   * Stops recording the logger's lines, call it on the logger's own thread
+   * */
+  void detachLogger(DebugLogger &logger) { logger.setMessageHook(nullptr); }
+
+  /**
+   * Writes every buffered event as Chrome Trace Event json
+   * */
+  void exportChromeTrace(std::ostream &output) {
+    std::lock_guard<std::mutex> threads(threadsLock);
+    std::lock_guard<std::mutex> namesGuard(namesLock);
+    char line[96];
+    bool first = true;
+
+    output << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+    for (const std::unique_ptr<ThreadBuffer> &buffer : threadBuffers) {
+      output << (first ? "\n" : ",\n");
+      first = false;
+      snprintf(line, sizeof(line),
+               "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+               "\"args\":{\"name\":",
+               buffer->threadIndex);
+      output << line;
+      writeJsonString(output, buffer->name.c_str(), buffer->name.size());
+      output << "}}";
+
+      uint64_t written = buffer->written.load(std::memory_order_acquire);
+      uint64_t firstEvent =
+          written > eventCapacity ? written - eventCapacity : 0;
+      firstEvent = std::max(firstEvent,
+                            buffer->cleared.load(std::memory_order_relaxed));
+      uint32_t messagesWritten =
+          buffer->messagesWritten.load(std::memory_order_acquire);
+
+      for (uint64_t i = firstEvent; i < written; ++i) {
+        const TraceEvent &event = buffer->events[i & (eventCapacity - 1)];
+        double timestamp =
+            event.timestamp >= startTime
+                ? (double)(event.timestamp - startTime) / 1000.0
+                : -(double)(startTime - event.timestamp) / 1000.0;
+
+        output << ",\n{\"name\":";
+        const std::string &name =
+            event.name < names.size() ? names[event.name] : unknownName;
+        writeJsonString(output, name.c_str(), name.size());
+
+        snprintf(line, sizeof(line),
+                 ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u",
+                 (char)event.phase, timestamp, buffer->threadIndex);
+        output << line;
+
+        if (event.phase == 'i') {
+          output << ",\"s\":\"t\"";
+        }
+
+        // the message is gone if the message ring wrapped past it
+        if (event.message != NO_MESSAGE &&
+            messagesWritten - event.message <= messageCapacity) {
+          const char *text =
+              &buffer->messages[(event.message & (messageCapacity - 1)) *
+                                MESSAGE_SIZE];
+          output << ",\"cat\":\"log\",\"args\":{\"message\":";
+          writeJsonString(output, text, strlen(text));
+          output << "}";
+        }
+
+        output << "}";
+      }
+    }
+
+    output << "\n]}\n";
+  }
+
+  /**
+   * Writes the trace to a file
+   * @return true if the file could be written
+   * */
+  bool exportChromeTrace(const std::string &path) {
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+
+    if (!file) {
+      return false;
+    }
+
+    exportChromeTrace(file);
+    return (bool)file;
+  }
+
+  /**
+   * Drops every recorded event but keeps names and threads
+   * The rings are left to their threads, which may still be recording, only
+   * the point export starts from moves up to what was written so far
+   * */
+  void clear() {
+    std::lock_guard<std::mutex> lock(threadsLock);
+
+    for (const std::unique_ptr<ThreadBuffer> &buffer : threadBuffers) {
+      buffer->cleared.store(buffer->written.load(std::memory_order_acquire),
+                            std::memory_order_relaxed);
+    }
+  }
+
+private:
+  struct ThreadBuffer {
+    std::unique_ptr<TraceEvent[]> events;
+    std::atomic<uint64_t> written{0};
+
+    // events before this one were dropped by clear
+    std::atomic<uint64_t> cleared{0};
+
+    // text of log lines, allocated the first time the thread logs
+    std::unique_ptr<char[]> messages;
+    std::atomic<uint32_t> messagesWritten{0};
+
+    uint32_t threadIndex = 0;
+    std::string name;
+  };
+
+  inline void record(uint32_t nameId, char phase, uint32_t message) {
+    ThreadBuffer *buffer = localBuffer();
+    uint64_t index = buffer->written.load(std::memory_order_relaxed);
+    TraceEvent &event = buffer->events[index & (eventCapacity - 1)];
+    event.timestamp = Timer::now();
+    event.name = nameId < MAX_NAME_ID ? nameId : MAX_NAME_ID;
+    event.phase = (uint32_t)phase;
+    event.message = message;
+    buffer->written.store(index + 1, std::memory_order_release);
+  }
+
+  /**
+   * Returns the calling thread's buffer, creating it on first use
+   * The last recorder a thread used is cached, so this is normally a single
+   * thread local compare
+   * */
+  inline ThreadBuffer *localBuffer() {
+    struct Cache {
+      uint64_t recorderId = 0;
+      ThreadBuffer *buffer = nullptr;
+    };
+    static thread_local Cache cache;
+
+    if (cache.recorderId != id) {
+      cache.buffer = findThreadBuffer();
+      cache.recorderId = id;
+    }
+
+    return cache.buffer;
+  }
+
+  ThreadBuffer *findThreadBuffer() {
+    std::lock_guard<std::mutex> lock(threadsLock);
+    std::thread::id thread = std::this_thread::get_id();
+    std::map<std::thread::id, ThreadBuffer *>::iterator found =
+        threadLookup.find(thread);
+
+    if (found != threadLookup.end()) {
+      return found->second;
+    }
+
+    ThreadBuffer *buffer = new ThreadBuffer();
+    buffer->events.reset(new TraceEvent[eventCapacity]);
+    buffer->threadIndex = (uint32_t)threadBuffers.size() + 1;
+    buffer->name = "thread " + std::to_string(buffer->threadIndex);
+    threadBuffers.emplace_back(buffer);
+    threadLookup.emplace(thread, buffer);
+    return buffer;
+  }
+
+  static void loggerHook(void *context, Level lev, const char *line,
+                         size_t length) {
+    TraceRecorder *recorder = (TraceRecorder *)context;
+    ThreadBuffer *buffer = recorder->localBuffer();
+
+    if (!buffer->messages) {
+      buffer->messages.reset(
+          new char[recorder->messageCapacity * MESSAGE_SIZE]);
+    }
+
+    // drop the newline and keep what fits
+    if (length && line[length - 1] == '\n') {
+      length--;
+    }
+
+    length = length < MESSAGE_SIZE - 1 ? length : MESSAGE_SIZE - 1;
+
+    uint32_t message =
+        buffer->messagesWritten.load(std::memory_order_relaxed);
+    char *text = &buffer->messages[(message & (recorder->messageCapacity - 1)) *
+                                   MESSAGE_SIZE];
+    memcpy(text, line, length);
+    text[length] = 0;
+    buffer->messagesWritten.store(message + 1, std::memory_order_release);
+
+    recorder->record(recorder->levelNameIds[(int)lev], 'i', message);
+  }
+
+  static void writeJsonString(std::ostream &output, const char *text,
+                              size_t length) {
+    output << '"';
+
+    for (size_t i = 0; i < length; ++i) {
+      unsigned char c = (unsigned char)text[i];
+
+      if (c == '"' || c == '\\') {
+        output << '\\' << (char)c;
+      } else if (c < 0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        output << escaped;
+      } else {
+        output << (char)c;
+      }
+    }
+
+    output << '"';
+  }
+
+  static size_t roundUp(size_t value) {
+    size_t power = 1;
+
+    while (power < value) {
+      power <<= 1;
+    }
+
+    return power;
+  }
+
+  static uint64_t nextRecorderId() {
+    static std::atomic<uint64_t> recorderIds(0);
+    return ++recorderIds;
+  }
+
+  const uint64_t id;
+  const size_t eventCapacity;
+  const size_t messageCapacity;
+  const uint64_t startTime;
+
+  std::mutex namesLock;
+  std::vector<std::string> names;
+  std::unordered_map<std::string, uint32_t> nameIds;
+  std::atomic<uint64_t> nameOverflows{0};
+  const std::string unknownName = "?";
+
+  std::mutex threadsLock;
+  std::vector<std::unique_ptr<ThreadBuffer>> threadBuffers;
+  std::map<std::thread::id, ThreadBuffer *> threadLookup;
+
+  // set once under threadsLock, by the first attachLogger
+  uint32_t levelNameIds[(int)Level::LEVEL_COUNT + 1] = {0};
+  bool levelNamesSet = false;
+};
+
+/**
+ * Records a begin event now and the matching end event when it goes out of
+ * scope
+ * */
+class TraceSpan {
+public:
+  TraceSpan(TraceRecorder &recorder, uint32_t nameId)
+      : recorder(recorder), nameId(nameId) {
+    recorder.begin(nameId);
+  }
+
+  ~TraceSpan() { recorder.end(nameId); }
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+  TraceRecorder &recorder;
+  uint32_t nameId;
+};
+
+#define TRACE_RECORDER_CONCAT_INNER(a, b) a##b
+#define TRACE_RECORDER_CONCAT(a, b) TRACE_RECORDER_CONCAT_INNER(a, b)
+
+/**
+ * Records the rest of the scope as a span, interning the name only the first
+ * time the line runs. The recorder must be the same object every time
+ * */
+#define TRACE_SPAN(recorder, name)                                            \
+  static const uint32_t TRACE_RECORDER_CONCAT(traceSpanName_, __LINE__) =    \
+      (recorder).intern(name);                                                \
+  TraceSpan TRACE_RECORDER_CONCAT(traceSpan_, __LINE__)(                      \
+      (recorder), TRACE_RECORDER_CONCAT(traceSpanName_, __LINE__))
+
+/**
+ * Records an instant event, interning the name only the first time
+ * */
+#define TRACE_INSTANT(recorder, name)                                         \
+  do {                                                                        \
+    static const uint32_t traceInstantName = (recorder).intern(name);         \
+    (recorder).instant(traceInstantName);                                     \
+  } while (0)
+
+#endif
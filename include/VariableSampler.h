@@ -0,0 +1,530 @@
+#ifndef INCLUDE_VARIABLE_SAMPLER_H
+#define INCLUDE_VARIABLE_SAMPLER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DebugLogger.h"
+#include "Timer.h"
+
+/**
+ * Time series file format written by VariableSampler and read by
+ * TimeSeriesReader. All integers are LEB128 varints unless noted
+ *
+ * header:
+ *   "DLTS" magic, format version (1 byte), sample interval in nanoseconds,
+ *   column count, then for every column its kind (1 byte, 0 integer, 1 float),
+ *   name length and name
+ * block (repeated):
+ *   'B' marker (1 byte), row count,
+ *   timestamp column: zigzag delta of each Timer::now() from the row before,
+ *   then every variable column in order:
+ *     integer: zigzag delta from the row before
+ *     float: bits xor the row before, byte swapped so the sign, exponent and
+ *     top of the mantissa (which rarely change) end up in the low bytes
+ * Deltas restart from 0 at every block, so each block decodes on its own
+ * */
+namespace TimeSeriesFormat {
+constexpr char MAGIC[4] = {'D', 'L', 'T', 'S'};
+constexpr uint8_t VERSION = 1;
+constexpr uint8_t BLOCK_MARKER = 'B';
+constexpr uint8_t COLUMN_INTEGER = 0;
+constexpr uint8_t COLUMN_FLOAT = 1;
+
+inline void writeVarint(std::vector<uint8_t> &output, uint64_t value) {
+  while (value >= 0x80) {
+    output.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+
+  output.push_back((uint8_t)value);
+}
+
+inline bool readVarint(FILE *file, uint64_t &value) {
+  value = 0;
+
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(file);
+
+    if (c == EOF) {
+      return false;
+    }
+
+    value |= (uint64_t)(c & 0x7f) << shift;
+
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+inline uint64_t zigzag(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+inline uint64_t byteSwap(uint64_t value) {
+  uint64_t swapped = 0;
+
+  for (int i = 0; i < 8; ++i) {
+    swapped = (swapped << 8) | (value & 0xff);
+    value >>= 8;
+  }
+
+  return swapped;
+}
+
+inline uint64_t doubleBits(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+inline double bitsDouble(uint64_t bits) {
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+} // namespace TimeSeriesFormat
+
+/**
+ * Samples registered logger variables on a background thread at a fixed
+ * interval and appends them to a compact columnar time series file
+ * Rows are collected in memory and written a block at a time
+ * The variables are read from the sampler's thread, so variables updated by
+ * other threads should be one of the atomic variable types
+ * String variables can't be sampled, unsigned 64 bit values above INT64_MAX
+ * show up negative in the reader
+ * */
+class VariableSampler {
+public:
+  /**
+   * @param logger the logger whose variables are sampled
+   * @param path the file to write, it is replaced if it exists
+   * @param intervalNanoseconds time between samples
+   * @param rowsPerBlock number of samples collected before a block is written
+   * */
+  VariableSampler(DebugLogger &logger, const std::string &path,
+                  uint64_t intervalNanoseconds, size_t rowsPerBlock = 256)
+      : logger(logger), path(path), interval(intervalNanoseconds),
+        rowsPerBlock(rowsPerBlock ? rowsPerBlock : 1) {}
+
+  ~VariableSampler() { stop(); }
+
+  VariableSampler(const VariableSampler &) = delete;
+  VariableSampler &operator=(const VariableSampler &) = delete;
+
+  /**
+   * Adds a variable to sample, must be called before start()
+   * @return false if the variable doesn't exist, is a string, or sampling has
+   * already started
+   * */
+  bool addVariable(const std::string &name) {
+    DebugLogger::DebugVar var(DebugVarType::CHAR, nullptr);
+
+    if (!logger.findVariable(name, var) || running ||
+        var.getType() == DebugVarType::STRING ||
+        var.getType() == DebugVarType::STRING_VIEW) {
+      return false;
+    }
+
+    Column column(var);
+    column.name = name;
+    column.kind = (var.getType() == DebugVarType::FLOAT32 ||
+                   var.getType() == DebugVarType::FLOAT64 ||
+                   var.getType() == DebugVarType::ATOMIC_FLOAT64)
+                      ? TimeSeriesFormat::COLUMN_FLOAT
+                      : TimeSeriesFormat::COLUMN_INTEGER;
+    columns.push_back(column);
+    return true;
+  }
+
+  /**
+   * Opens the file and starts the sampling thread
+   * @return false if the file could not be opened
+   * */
+  bool start() {
+    if (running) {
+      return true;
+    }
+
+    file = fopen(path.c_str(), "wb");
+
+    if (!file) {
+      return false;
+    }
+
+    writeHeader();
+    stopping = false;
+    running = true;
+    sampler = std::thread(&VariableSampler::run, this);
+    return true;
+  }
+
+  /**
+   * Stops the thread and writes the rows that haven't been written yet
+   * */
+  void stop() {
+    if (!running) {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(stopLock);
+      stopping = true;
+    }
+
+    stopSignal.notify_all();
+    sampler.join();
+    writeBlock();
+    fclose(file);
+    file = nullptr;
+    running = false;
+  }
+
+  /**
+   * Number of samples taken so far
+   * */
+  uint64_t getSampleCount() const {
+    return sampleCount.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Column {
+    explicit Column(const DebugLogger::DebugVar &var) : var(var) {}
+
+    std::string name;
+    DebugLogger::DebugVar var;
+    uint8_t kind;
+    std::vector<uint64_t> values;
+  };
+
+  void run() {
+    std::unique_lock<std::mutex> lock(stopLock);
+    uint64_t next = Timer::now();
+
+    while (!stopping) {
+      sample();
+      next += interval;
+
+      uint64_t now = Timer::now();
+
+      // fell behind, skip the missed samples instead of bursting
+      if (next < now) {
+        next = now + interval;
+      }
+
+      stopSignal.wait_for(lock, std::chrono::nanoseconds(next - now),
+                          [this]() { return stopping; });
+    }
+  }
+
+  void sample() {
+    timestamps.push_back(Timer::now());
+
+    for (Column &column : columns) {
+      column.values.push_back(readValue(column));
+    }
+
+    sampleCount.fetch_add(1, std::memory_order_relaxed);
+
+    if (timestamps.size() >= rowsPerBlock) {
+      writeBlock();
+    }
+  }
+
+  static uint64_t readValue(Column &column) {
+    DebugLogger::DebugVar &var = column.var;
+
+    switch (var.getType()) {
+    case DebugVarType::CHAR:
+      return (uint64_t)(int64_t)var.getChar();
+    case DebugVarType::INTEGER32:
+      return (uint64_t)(int64_t)var.getInt32();
+    case DebugVarType::INTEGER64:
+      return (uint64_t)var.getInt64();
+    case DebugVarType::FLOAT32:
+      return TimeSeriesFormat::doubleBits(var.getFloat32());
+    case DebugVarType::FLOAT64:
+      return TimeSeriesFormat::doubleBits(var.getFloat64());
+    case DebugVarType::UNSIGNED32:
+      return var.getUInt32();
+    case DebugVarType::UNSIGNED64:
+      return var.getUInt64();
+    case DebugVarType::BOOL:
+      return var.getBool() ? 1 : 0;
+    case DebugVarType::ATOMIC_INTEGER64:
+      return (uint64_t)var.getAtomicInt64();
+    case DebugVarType::ATOMIC_UNSIGNED64:
+      return var.getAtomicUInt64();
+    case DebugVarType::ATOMIC_FLOAT64:
+      return TimeSeriesFormat::doubleBits(var.getAtomicFloat64());
+    default:
+      return 0;
+    }
+  }
+
+  void writeHeader() {
+    std::vector<uint8_t> header(TimeSeriesFormat::MAGIC,
+                                TimeSeriesFormat::MAGIC + 4);
+    header.push_back(TimeSeriesFormat::VERSION);
+    TimeSeriesFormat::writeVarint(header, interval);
+    TimeSeriesFormat::writeVarint(header, columns.size());
+
+    for (const Column &column : columns) {
+      header.push_back(column.kind);
+      TimeSeriesFormat::writeVarint(header, column.name.size());
+      header.insert(header.end(), column.name.begin(), column.name.end());
+    }
+
+    fwrite(header.data(), 1, header.size(), file);
+    fflush(file);
+  }
+
+  void writeBlock() {
+    if (timestamps.empty()) {
+      return;
+    }
+
+    block.clear();
+    block.push_back(TimeSeriesFormat::BLOCK_MARKER);
+    TimeSeriesFormat::writeVarint(block, timestamps.size());
+
+    uint64_t previous = 0;
+    for (uint64_t timestamp : timestamps) {
+      TimeSeriesFormat::writeVarint(
+          block, TimeSeriesFormat::zigzag((int64_t)(timestamp - previous)));
+      previous = timestamp;
+    }
+
+    for (Column &column : columns) {
+      previous = 0;
+
+      for (uint64_t value : column.values) {
+        if (column.kind == TimeSeriesFormat::COLUMN_FLOAT) {
+          TimeSeriesFormat::writeVarint(
+              block, TimeSeriesFormat::byteSwap(value ^ previous));
+        } else {
+          TimeSeriesFormat::writeVarint(
+              block, TimeSeriesFormat::zigzag((int64_t)(value - previous)));
+        }
+
+        previous = value;
+      }
+
+      column.values.clear();
+    }
+
+    timestamps.clear();
+    fwrite(block.data(), 1, block.size(), file);
+    fflush(file);
+  }
+
+  DebugLogger &logger;
+  std::string path;
+  uint64_t interval;
+  size_t rowsPerBlock;
+
+  std::vector<Column> columns;
+  std::vector<uint64_t> timestamps;
+  std::vector<uint8_t> block;
+  FILE *file = nullptr;
+
+  std::thread sampler;
+  std::mutex stopLock;
+  std::condition_variable stopSignal;
+  bool stopping = false;
+  bool running = false;
+  std::atomic<uint64_t> sampleCount{0};
+};
+
+/**
+ * Reads a file written by VariableSampler one row at a time
+ * */
+class TimeSeriesReader {
+public:
+  struct ColumnInfo {
+    std::string name;
+    bool isFloat;
+  };
+
+  /**
+   * One decoded sample, values are int64_t or double depending on the column
+   * */
+  struct Row {
+    uint64_t timestamp;
+    std::vector<int64_t> integers;
+    std::vector<double> floats;
+  };
+
+  TimeSeriesReader() {}
+
+  ~TimeSeriesReader() {
+    if (file) {
+      fclose(file);
+    }
+  }
+
+  TimeSeriesReader(const TimeSeriesReader &) = delete;
+  TimeSeriesReader &operator=(const TimeSeriesReader &) = delete;
+
+  /**
+   * Opens the file and reads its header
+   * @return false if the file can't be read or isn't a time series file
+   * */
+  bool open(const std::string &path) {
+    file = fopen(path.c_str(), "rb");
+
+    if (!file || fseek(file, 0, SEEK_END) != 0) {
+      return false;
+    }
+
+    fileSize = (uint64_t)ftell(file);
+    rewind(file);
+
+    char magic[4];
+    uint64_t columnCount = 0;
+
+    if (fread(magic, 1, 4, file) != 4 ||
+        memcmp(magic, TimeSeriesFormat::MAGIC, 4) != 0 ||
+        fgetc(file) != TimeSeriesFormat::VERSION ||
+        !TimeSeriesFormat::readVarint(file, interval) ||
+        !TimeSeriesFormat::readVarint(file, columnCount)) {
+      return false;
+    }
+
+    for (uint64_t i = 0; i < columnCount; ++i) {
+      int kind = fgetc(file);
+      uint64_t nameLength = 0;
+
+      if (kind == EOF || !TimeSeriesFormat::readVarint(file, nameLength) ||
+          nameLength > 4096) {
+        return false;
+      }
+
+      ColumnInfo column;
+      column.name.resize(nameLength);
+      column.isFloat = kind == TimeSeriesFormat::COLUMN_FLOAT;
+
+      if (fread(&column.name[0], 1, nameLength, file) != nameLength) {
+        return false;
+      }
+
+      columns.push_back(column);
+    }
+
+    return true;
+  }
+
+  const std::vector<ColumnInfo> &getColumns() const { return columns; }
+
+  uint64_t getInterval() const { return interval; }
+
+  /**
+   * Reads the next row
+   * @return false at the end of the file or on a damaged block
+   * */
+  bool next(Row &row) {
+    if (rowInBlock == blockRows && !readBlock()) {
+      return false;
+    }
+
+    row.timestamp = timestamps[rowInBlock];
+    row.integers.assign(columns.size(), 0);
+    row.floats.assign(columns.size(), 0);
+
+    for (size_t c = 0; c < columns.size(); ++c) {
+      uint64_t value = values[c * blockRows + rowInBlock];
+
+      if (columns[c].isFloat) {
+        row.floats[c] = TimeSeriesFormat::bitsDouble(value);
+      } else {
+        row.integers[c] = (int64_t)value;
+      }
+    }
+
+    rowInBlock++;
+    return true;
+  }
+
+private:
+  bool readBlock() {
+    uint64_t rows = 0;
+
+    if (!file || fgetc(file) != TimeSeriesFormat::BLOCK_MARKER ||
+        !TimeSeriesFormat::readVarint(file, rows) || rows == 0) {
+      return false;
+    }
+
+    // every timestamp and value takes at least a byte, so a damaged count
+    // is caught before it is allocated
+    uint64_t remaining = fileSize - (uint64_t)ftell(file);
+
+    if (rows > remaining / (columns.size() + 1)) {
+      return false;
+    }
+
+    timestamps.assign(rows, 0);
+    values.assign(rows * columns.size(), 0);
+
+    uint64_t previous = 0;
+    for (uint64_t r = 0; r < rows; ++r) {
+      uint64_t encoded;
+
+      if (!TimeSeriesFormat::readVarint(file, encoded)) {
+        return false;
+      }
+
+      previous += (uint64_t)TimeSeriesFormat::unzigzag(encoded);
+      timestamps[r] = previous;
+    }
+
+    for (size_t c = 0; c < columns.size(); ++c) {
+      previous = 0;
+
+      for (uint64_t r = 0; r < rows; ++r) {
+        uint64_t encoded;
+
+        if (!TimeSeriesFormat::readVarint(file, encoded)) {
+          return false;
+        }
+
+        if (columns[c].isFloat) {
+          previous ^= TimeSeriesFormat::byteSwap(encoded);
+        } else {
+          previous += (uint64_t)TimeSeriesFormat::unzigzag(encoded);
+        }
+
+        values[c * rows + r] = previous;
+      }
+    }
+
+    blockRows = rows;
+    rowInBlock = 0;
+    return true;
+  }
+
+  FILE *file = nullptr;
+  uint64_t fileSize = 0;
+  uint64_t interval = 0;
+  std::vector<ColumnInfo> columns;
+
+  std::vector<uint64_t> timestamps;
+  std::vector<uint64_t> values;
+  uint64_t blockRows = 0;
+  uint64_t rowInBlock = 0;
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "FileSink.h"
+#include "IndexedFileSink.h"
+#include "SharedMemoryLog.h"
+#include "Timer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Collects the lines worker processes log through SharedMemorySink and
+ * writes them in timestamp order
+ * Makes the shared memory segment, drains it every interval until SIGINT or
+ * SIGTERM, then writes what is left and removes the segment
+ *
+ * usage: DebugLoggerCollector <name> [options]
+ *   --output FILE      append the lines to a file, stdout by default
+ *   --indexed FILE     also write an indexed log, see DebugLoggerQuery, the
+ *                      lines have format id 0 since format strings stay in
+ *                      the worker processes, so --format matches none of them
+ *   --producers N      processes that can log at once, 64 by default
+ *   --ring-size BYTES  ring per process, 1MB by default
+ *   --interval MS      time between drains, 10 by default
+ *   --keep             leave the segment when exiting
+ * */
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int) { stopRequested = 1; }
+
+/**
+ * Sends every line to each of the sinks
+ * */
+class TeeSink : public LogSink {
+public:
+  void add(LogSink *sink) { sinks.push_back(sink); }
+
+  void write(const char *data, size_t size) override {
+    for (LogSink *sink : sinks) {
+      sink->write(data, size);
+    }
+  }
+
+  void writeMessage(const char *data, size_t size,
+                    const LogMessageInfo &info) override {
+    for (LogSink *sink : sinks) {
+      sink->writeMessage(data, size, info);
+    }
+  }
+
+  void flush() override {
+    for (LogSink *sink : sinks) {
+      sink->flush();
+    }
+  }
+
+private:
+  std::vector<LogSink *> sinks;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <name> [--output FILE] [--indexed FILE] "
+                    "[--producers N] [--ring-size BYTES] [--interval MS] "
+                    "[--keep]\n",
+            argv[0]);
+    return 1;
+  }
+
+  const char *output = nullptr;
+  const char *indexed = nullptr;
+  uint32_t producers = 64;
+  uint64_t ringSize = 1 << 20;
+  int64_t interval = 10000000;
+  bool keep = false;
+
+  for (int i = 2; i < argc; ++i) {
+    std::string option = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (option == "--keep") {
+      keep = true;
+      continue;
+    } else if (!value) {
+      fprintf(stderr, "missing value for %s\n", argv[i]);
+      return 1;
+    } else if (option == "--output") {
+      output = value;
+    } else if (option == "--indexed") {
+      indexed = value;
+    } else if (option == "--producers") {
+      producers = (uint32_t)std::max(1, atoi(value));
+    } else if (option == "--ring-size") {
+      ringSize = strtoull(value, nullptr, 10);
+    } else if (option == "--interval") {
+      interval = (int64_t)std::max(1, atoi(value)) * 1000000;
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+
+    i++;
+  }
+
+  SharedMemoryCollector collector;
+
+  if (!collector.create(argv[1], producers, ringSize)) {
+    fprintf(stderr,
+            "%s: can't create the shared memory segment, or another "
+            "collector is using it\n",
+            argv[1]);
+    return 1;
+  }
+
+  TeeSink target;
+  std::unique_ptr<BufferedFileSink> text(
+      output ? new BufferedFileSink(output, 1 << 20)
+             : new BufferedFileSink(STDOUT_FILENO, 1 << 20, false));
+  std::unique_ptr<IndexedFileSink> index(
+      indexed ? new IndexedFileSink(indexed) : nullptr);
+
+  if (!text->isOpen() || (index && !index->isOpen())) {
+    fprintf(stderr, "can't open the output files\n");
+    return 1;
+  }
+
+  target.add(text.get());
+
+  if (index) {
+    target.add(index.get());
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = &requestStop;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  while (!stopRequested) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(interval));
+
+    // lines are held back an interval so slower producers can catch up,
+    // unless every producer is already past them
+    int64_t now = Timer::unixNow();
+    int64_t cutoff = std::max(
+        now - interval, std::min(now, collector.watermark(now - interval)));
+
+    if (collector.drain(target, cutoff)) {
+      target.flush();
+    }
+  }
+
+  collector.drain(target, INT64_MAX);
+  target.flush();
+
+  if (!keep) {
+    collector.unlink();
+  }
+
+  return 0;
+}
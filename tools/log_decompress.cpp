@@ -0,0 +1,35 @@
+#include "LogCompression.h"
+
+#include <stdio.h>
+
+/**
+ * Prints the text of a log file written by CompressedFileSink
+ *
+ * usage: DebugLoggerDecompress <file>
+ * */
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <file>\n", argv[0]);
+    return 1;
+  }
+
+  LogCompression::CompressedLogReader reader;
+
+  if (!reader.open(argv[1])) {
+    fprintf(stderr, "%s: not a readable compressed log file\n", argv[1]);
+    return 1;
+  }
+
+  std::string text;
+
+  while (reader.next(text)) {
+    fwrite(text.data(), 1, text.size(), stdout);
+  }
+
+  if (reader.isCorrupt()) {
+    fprintf(stderr, "%s: corrupt or truncated block\n", argv[1]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+#include "FileSink.h"
+#include "SocketSink.h"
+
+#include <map>
+#include <memory>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/**
+ * Receives the lines SocketSink sends and writes them out, a stand-in for a
+ * real collector
+ * Listens on a Unix domain socket until SIGINT or SIGTERM, then removes it
+ *
+ * usage: DebugLoggerListener <socket path> [options]
+ *   --datagram     listen on a datagram socket, a stream socket by default
+ *   --records      the sinks use Framing::RECORDS
+ *   --output FILE  append the lines to a file, stdout by default
+ * */
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int) { stopRequested = 1; }
+
+/**
+ * Writes the complete lines or records at the start of pending and removes
+ * them, the rest waits for more data
+ * */
+void writeComplete(std::string &pending, bool records, LogSink &output) {
+  size_t position = 0;
+
+  while (position < pending.size()) {
+    if (records) {
+      if (pending.size() - position < SocketSink::RECORD_HEADER_SIZE) {
+        break;
+      }
+
+      uint32_t size;
+      memcpy(&size, pending.data() + position, 4);
+
+      if (pending.size() - position - SocketSink::RECORD_HEADER_SIZE < size) {
+        break;
+      }
+
+      output.write(pending.data() + position + SocketSink::RECORD_HEADER_SIZE,
+                   size);
+      position += SocketSink::RECORD_HEADER_SIZE + size;
+    } else {
+      size_t end = pending.find('\n', position);
+
+      if (end == std::string::npos) {
+        break;
+      }
+
+      output.write(pending.data() + position, end + 1 - position);
+      position = end + 1;
+    }
+  }
+
+  pending.erase(0, position);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "usage: %s <socket path> [--datagram] [--records] [--output FILE]\n",
+            argv[0]);
+    return 1;
+  }
+
+  int type = SOCK_STREAM;
+  bool records = false;
+  const char *outputPath = nullptr;
+
+  for (int i = 2; i < argc; ++i) {
+    std::string option = argv[i];
+
+    if (option == "--datagram") {
+      type = SOCK_DGRAM;
+    } else if (option == "--records") {
+      records = true;
+    } else if (option == "--output" && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+  ::unlink(argv[1]);
+
+  int listener = ::socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+
+  if (listener < 0 ||
+      ::bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      (type == SOCK_STREAM && ::listen(listener, 16) != 0)) {
+    fprintf(stderr, "%s: can't listen on the socket\n", argv[1]);
+    return 1;
+  }
+
+  std::unique_ptr<BufferedFileSink> file(
+      outputPath ? new BufferedFileSink(outputPath, 1 << 16)
+                 : new BufferedFileSink(STDOUT_FILENO, 1 << 16, false));
+  BufferedFileSink &output = *file;
+
+  if (!output.isOpen()) {
+    fprintf(stderr, "%s: can't open the output\n",
+            outputPath ? outputPath : "stdout");
+    return 1;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = &requestStop;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  // a stream can cut a line in two, the start waits here for the rest
+  std::map<int, std::string> pending;
+  std::vector<char> buffer(1 << 20);
+  std::vector<struct pollfd> polled;
+
+  while (!stopRequested) {
+    polled.clear();
+    polled.push_back({listener, POLLIN, 0});
+
+    for (const auto &client : pending) {
+      polled.push_back({client.first, POLLIN, 0});
+    }
+
+    if (::poll(polled.data(), polled.size(), 100) <= 0) {
+      output.flush();
+      continue;
+    }
+
+    for (const struct pollfd &entry : polled) {
+      if (!entry.revents) {
+        continue;
+      }
+
+      if (entry.fd == listener && type == SOCK_STREAM) {
+        int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (client >= 0) {
+          pending[client];
+        }
+
+        continue;
+      }
+
+      ssize_t received = ::recv(entry.fd, buffer.data(), buffer.size(), 0);
+
+      if (received <= 0 && entry.fd != listener) {
+        ::close(entry.fd);
+        pending.erase(entry.fd);
+        continue;
+      }
+
+      if (received > 0) {
+        // every datagram holds whole lines
+        std::string &data = pending[entry.fd == listener ? -1 : entry.fd];
+        data.append(buffer.data(), (size_t)received);
+        writeComplete(data, records, output);
+      }
+    }
+
+    pending.erase(-1);
+  }
+
+  output.flush();
+  ::close(listener);
+  ::unlink(argv[1]);
+  return 0;
+}
@@ -0,0 +1,308 @@
+#include "IndexedFileSink.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+/**
+ * Prints the messages of a log written by IndexedFileSink that match every
+ * given filter, in the order they were written
+ * Blocks the index rules out are never read, the rest are scanned in
+ * parallel
+ *
+ * usage: DebugLoggerQuery <file> [options]
+ *   --from TIME, --to TIME   messages logged in [from, to]
+ *     TIME is HH:MM[:SS] on the day of the first message (local time),
+ *     YYYY-MM-DD HH:MM[:SS], or +SECONDS after the first message
+ *   --level NAMES            messages of the listed levels, comma separated
+ *                            from trace, warning, error, critical
+ *   --min-level NAME         messages of the level or above
+ *   --format TEXT            messages logged with exactly this format string
+ *   --grep TEXT              messages containing the text
+ *   --time                   print the local time before each message
+ *   --threads N              threads to scan with, all cores by default
+ *   --stats                  print how many blocks were read to stderr
+ * */
+
+namespace {
+
+struct Query {
+  int64_t from = INT64_MIN;
+  int64_t to = INT64_MAX;
+  uint32_t levelMask = ~0u;
+  bool hasFormat = false;
+  uint32_t formatId = 0;
+  std::string grep;
+  bool printTime = false;
+};
+
+const char *const LEVEL_NAMES[] = {"", "trace", "warning", "error",
+                                   "critical"};
+
+int levelFromName(const char *name, size_t length) {
+  for (int l = 1; l < 5; ++l) {
+    if (strlen(LEVEL_NAMES[l]) == length &&
+        strncmp(LEVEL_NAMES[l], name, length) == 0) {
+      return l;
+    }
+  }
+
+  return -1;
+}
+
+bool parseLevels(const char *names, uint32_t &mask) {
+  mask = 0;
+
+  while (*names) {
+    const char *end = strchr(names, ',');
+    size_t length = end ? (size_t)(end - names) : strlen(names);
+    int l = levelFromName(names, length);
+
+    if (l < 0) {
+      return false;
+    }
+
+    mask |= 1u << l;
+    names += length + (end ? 1 : 0);
+  }
+
+  return mask != 0;
+}
+
+/**
+ * @param first the time of the first message, for times relative to it
+ * */
+bool parseTime(const char *text, int64_t first, int64_t &nanoseconds) {
+  if (text[0] == '+') {
+    char *end;
+    double seconds = strtod(text + 1, &end);
+    nanoseconds = first + (int64_t)(seconds * 1e9);
+    return *end == 0;
+  }
+
+  struct tm date;
+  time_t firstSeconds = (time_t)(first / 1000000000);
+  localtime_r(&firstSeconds, &date);
+
+  int hours = 0, minutes = 0;
+  double seconds = 0;
+  const char *clock = text;
+
+  if (strlen(text) > 10 && (text[10] == ' ' || text[10] == 'T')) {
+    if (sscanf(text, "%d-%d-%d", &date.tm_year, &date.tm_mon, &date.tm_mday) !=
+        3) {
+      return false;
+    }
+
+    date.tm_year -= 1900;
+    date.tm_mon -= 1;
+    clock = text + 11;
+  }
+
+  if (sscanf(clock, "%d:%d:%lf", &hours, &minutes, &seconds) < 2) {
+    return false;
+  }
+
+  date.tm_hour = hours;
+  date.tm_min = minutes;
+  date.tm_sec = 0;
+  date.tm_isdst = -1;
+  nanoseconds = (int64_t)mktime(&date) * 1000000000 + (int64_t)(seconds * 1e9);
+  return true;
+}
+
+bool blockMayMatch(const IndexedLogFormat::BlockInfo &block,
+                   const Query &query) {
+  return block.lastNanoseconds >= query.from &&
+         block.firstNanoseconds <= query.to &&
+         (block.levelMask & query.levelMask) != 0 &&
+         (!query.hasFormat || block.mayContainFormat(query.formatId));
+}
+
+void appendTime(std::string &output, int64_t nanoseconds) {
+  time_t seconds = (time_t)(nanoseconds / 1000000000);
+  struct tm date;
+  char text[64];
+
+  localtime_r(&seconds, &date);
+  size_t size = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &date);
+  size += (size_t)snprintf(text + size, sizeof(text) - size, ".%06d ",
+                           (int)(nanoseconds % 1000000000 / 1000));
+  output.append(text, size);
+}
+
+/**
+ * Appends the matching messages of a block to output
+ * @return false if the block couldn't be read completely
+ * */
+bool scanBlock(const IndexedLogReader &reader,
+               const IndexedLogFormat::BlockInfo &block, const Query &query,
+               std::vector<char> &data, std::string &output) {
+  bool complete = reader.readBlock(block, data);
+
+  auto onMessage = [&](const IndexedLogFormat::Message &message) {
+    if (message.unixNanoseconds < query.from ||
+        message.unixNanoseconds > query.to ||
+        !(query.levelMask & (1u << message.level)) ||
+        (query.hasFormat && message.formatId != query.formatId)) {
+      return;
+    }
+
+    std::string_view text(message.text, message.size);
+
+    if (!query.grep.empty() && text.find(query.grep) == std::string::npos) {
+      return;
+    }
+
+    if (query.printTime) {
+      appendTime(output, message.unixNanoseconds);
+    }
+
+    output.append(text.data(), text.size());
+  };
+
+  return IndexedLogFormat::forEachMessage(data.data(), data.size(),
+                                          onMessage) &&
+         complete;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <file> [--from TIME] [--to TIME] "
+                    "[--level NAMES] [--min-level NAME] [--format TEXT] "
+                    "[--grep TEXT] [--time] [--threads N] [--stats]\n",
+            argv[0]);
+    return 1;
+  }
+
+  IndexedLogReader reader;
+
+  if (!reader.open(argv[1])) {
+    fprintf(stderr, "%s: not a readable indexed log file\n", argv[1]);
+    return 1;
+  }
+
+  const std::vector<IndexedLogFormat::BlockInfo> &blocks = reader.getBlocks();
+  int64_t first = INT64_MAX;
+
+  for (const IndexedLogFormat::BlockInfo &block : blocks) {
+    if (block.firstNanoseconds != INT64_MIN) {
+      first = std::min(first, block.firstNanoseconds);
+    }
+  }
+
+  Query query;
+  unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+  bool printStats = false;
+
+  for (int i = 2; i < argc; ++i) {
+    std::string option = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool valid = true;
+
+    if (option == "--time") {
+      query.printTime = true;
+      continue;
+    } else if (option == "--stats") {
+      printStats = true;
+      continue;
+    } else if (!value) {
+      valid = false;
+    } else if (option == "--from") {
+      valid = parseTime(value, first, query.from);
+    } else if (option == "--to") {
+      valid = parseTime(value, first, query.to);
+    } else if (option == "--level") {
+      valid = parseLevels(value, query.levelMask);
+    } else if (option == "--min-level") {
+      int l = levelFromName(value, strlen(value));
+      valid = l > 0;
+      query.levelMask = valid ? ~0u << l : 0;
+    } else if (option == "--format") {
+      query.hasFormat = true;
+      query.formatId = IndexedLogFormat::formatId(value);
+    } else if (option == "--grep") {
+      query.grep = value;
+    } else if (option == "--threads") {
+      threadCount = (unsigned)std::max(1, atoi(value));
+    } else {
+      valid = false;
+    }
+
+    if (!valid) {
+      fprintf(stderr, "invalid option %s %s\n", argv[i], value ? value : "");
+      return 1;
+    }
+
+    i++;
+  }
+
+  std::vector<size_t> candidates;
+
+  for (size_t b = 0; b < blocks.size(); ++b) {
+    if (blockMayMatch(blocks[b], query)) {
+      candidates.push_back(b);
+    }
+  }
+
+  // blocks are scanned a batch at a time so the output stays in order
+  // without holding every result in memory
+  size_t batchSize = (size_t)threadCount * 8;
+  std::vector<std::string> results(batchSize);
+  std::atomic<bool> corrupt{false};
+
+  for (size_t start = 0; start < candidates.size(); start += batchSize) {
+    size_t count = std::min(batchSize, candidates.size() - start);
+    std::atomic<size_t> next{0};
+
+    auto work = [&]() {
+      std::vector<char> data;
+
+      for (size_t i = next++; i < count; i = next++) {
+        results[i].clear();
+
+        if (!scanBlock(reader, blocks[candidates[start + i]], query, data,
+                       results[i])) {
+          corrupt = true;
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (unsigned t = 1; t < threadCount && t < count; ++t) {
+      threads.emplace_back(work);
+    }
+
+    work();
+
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      fwrite(results[i].data(), 1, results[i].size(), stdout);
+    }
+  }
+
+  if (printStats) {
+    fprintf(stderr, "read %zu of %zu blocks\n", candidates.size(),
+            blocks.size());
+  }
+
+  if (corrupt) {
+    fprintf(stderr, "%s: truncated or corrupt block\n", argv[1]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,51 @@
+#include "VariableSampler.h"
+
+#include <stdio.h>
+
+/**
+ * Prints a time series file written by VariableSampler as csv
+ * The first column is the sample time in nanoseconds, then one column per
+ * sampled variable
+ *
+ * usage: DebugLoggerSampleDump <file>
+ * */
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <file>\n", argv[0]);
+    return 1;
+  }
+
+  TimeSeriesReader reader;
+
+  if (!reader.open(argv[1])) {
+    fprintf(stderr, "%s: not a readable time series file\n", argv[1]);
+    return 1;
+  }
+
+  const std::vector<TimeSeriesReader::ColumnInfo> &columns =
+      reader.getColumns();
+
+  printf("timestamp_ns");
+  for (const TimeSeriesReader::ColumnInfo &column : columns) {
+    printf(",%s", column.name.c_str());
+  }
+  printf("\n");
+
+  TimeSeriesReader::Row row;
+
+  while (reader.next(row)) {
+    printf("%llu", (unsigned long long)row.timestamp);
+
+    for (size_t c = 0; c < columns.size(); ++c) {
+      if (columns[c].isFloat) {
+        printf(",%.17g", row.floats[c]);
+      } else {
+        printf(",%lld", (long long)row.integers[c]);
+      }
+    }
+
+    printf("\n");
+  }
+
+  return 0;
+}